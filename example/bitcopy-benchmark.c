@@ -0,0 +1,108 @@
+/*
+ *  Created: 17.10.2026
+ */
+
+/*
+*	Compares the cost of copying a full FC1 response worth of bits (2000 coils)
+*	bit by bit with listBitCopy(), as modbusExchangeBits used to do, against a
+*	single listBitRangeCopy() call. Timer1 runs with prescaler 8, all results
+*	are cpu cycles divided by 8.
+*	The results are served as input registers (client address 0x01):
+*	register 0: listBitCopy() loop, source and target aligned
+*	register 1: listBitRangeCopy(), source and target aligned
+*	register 2: listBitCopy() loop, source misaligned by 3 bits
+*	register 3: listBitRangeCopy(), source misaligned by 3 bits
+*	register 4: 1 if both ways gave the same bits in both cases
+*	No figures have been taken on a target yet.
+*/
+
+#define clientAddress 0x01
+#define benchmarkBits 2000
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#define F_CPU 20000000
+#include "yaMBSiavr.h"
+
+volatile uint16_t inputRegisters[5];
+volatile uint8_t coils[benchmarkBits/8+1];
+volatile uint8_t frame[benchmarkBits/8+1];
+volatile uint8_t frameRange[benchmarkBits/8+1];
+
+void timer0100us_start(void) {
+	TCCR0B|=(1<<CS01); //prescaler 8
+	TIMSK0|=(1<<TOIE0);
+}
+
+ISR(TIMER0_OVF_vect) { //this ISR is called 9765.625 times per second
+	modbusTickTimer();
+}
+
+uint16_t bitwise(uint16_t sourceNr) {
+	uint16_t start=TCNT1;
+	for (uint16_t c = 0; c<benchmarkBits; c++)
+	{
+		listBitCopy(coils,sourceNr+c,frame,c);
+	}
+	return TCNT1-start;
+}
+
+uint16_t rangewise(uint16_t sourceNr) {
+	uint16_t start=TCNT1;
+	listBitRangeCopy(coils,sourceNr,frameRange,0,benchmarkBits);
+	return TCNT1-start;
+}
+
+uint8_t same(void) {
+	for (uint16_t c=0; c<benchmarkBits/8; c++) if (frame[c]!=frameRange[c]) return 0;
+	return 1;
+}
+
+void benchmark(void) {
+	for (uint16_t c=0; c<sizeof(coils); c++) coils[c]=(uint8_t)(c*13+5);
+	TCCR1A=0;
+	TCCR1B=(1<<CS11); //prescaler 8
+
+	cli();
+	inputRegisters[0]=bitwise(0);
+	inputRegisters[1]=rangewise(0);
+	inputRegisters[4]=same();
+	inputRegisters[2]=bitwise(3);
+	inputRegisters[3]=rangewise(3);
+	inputRegisters[4]&=same();
+	sei();
+}
+
+void modbusGet(void) {
+	if (modbusGetBusState() & (1<<ReceiveCompleted))
+	{
+		switch(rxbuffer[1]) {
+			case fcReadInputRegisters: {
+				modbusExchangeRegisters(inputRegisters,0,5);
+			}
+			break;
+
+			default: {
+				modbusSendException(ecIllegalFunction);
+			}
+			break;
+		}
+	}
+}
+
+int main(void)
+{
+	benchmark();
+	sei();
+	modbusSetAddress(clientAddress);
+	modbusInit();
+	wdt_enable(7);
+	timer0100us_start();
+
+	while(1)
+	{
+		wdt_reset();
+		modbusGet();
+	}
+}
@@ -0,0 +1,367 @@
+/*
+ *  Created: 17.10.2026
+ */
+
+/*
+*	Puts slaves of this library (or, built with -DMODBUS_MASTER, a master) on a
+*	simulated RS485 bus, see yaMBSsim.h, and measures how they cope with
+*	back-to-back frames, short gaps, gaps within frames, overlong frames, noise
+*	and collisions. The other end of the bus is played by this program and keeps
+*	to the timing of the specification: 3.5 characters of silence between
+*	frames (T3.5) and no more than 1.5 between the characters of a frame (T1.5),
+*	1.75ms and 0.75ms above 19200 baud.
+*	Build:	gcc -O2 -DMODBUS_HAL=HAL_SIM -I. example/bus-simulator.c yaMBSiavr.c yaMBSsim.c -o bus-simulator
+*	        with -DBAUD_SPD=9600 etc. for other baud rates, -DMODBUS_MASTER for the master
+*	Run:	./bus-simulator
+*	example/bus-simulator.sh runs both at several baud rates. Everything runs in
+*	virtual time, the results are the same on every run.
+*	Slaves (addresses 1 to 4, the main loop runs every 50us):
+*	throughput: a master reads 10 registers from the slaves one after another
+*	frame gap: requests that follow a response after less than T3.5
+*	character gap: requests with a gap between every two characters
+*	overlong: 300 bytes of garbage, then a request
+*	noise: throughput with random characters on the bus
+*	collision: two slaves with the same address
+*	idle: timer interrupts of a slave on a silent bus (see TIMING_MODE)
+*	quantity limits: fcReadWriteMultipleRegisters and fcMaskWriteRegister requests
+*	at and beyond the quantities the specification allows
+*	Master: reads 10 registers from four slaves one after another, without and
+*	with noise. The slaves answer after T3.5.
+*	stray characters: every other request of a slave is not answered, instead
+*	a stream of characters longer than a frame goes on until about T3.5 before
+*	the response timeout, ending at a different point in time on every try.
+*	The master ignores the rest of the stream and has to keep T3.5 after it
+*	when it sends its next request right at the timeout.
+*	Every line states the transactions per second, the share of requests that
+*	got no proper response and the shortest silence the instances kept before
+*	their frames.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "yaMBSsim.h"
+
+#define slaves 4
+#define seconds 10
+#define ns 1000000000ULL
+#define ms(x) ((x)*1000000ULL)
+#define responseTimeout ms(20) //after the end of a request
+
+static modbusSimBus bus;
+static uint64_t t35, t15; //ns
+static uint8_t received[MaxFrameIndex+1];
+static uint16_t receivedLength;
+static uint8_t receivedBroken;
+
+static uint16_t frameCrc(const uint8_t *data, uint16_t length)
+{
+	uint16_t crc=0xffff;
+	while (length--)
+	{
+		crc^=*data++;
+		for (uint8_t b=0; b<8; b++) crc=(crc&1) ? (crc>>1)^0xa001 : crc>>1;
+	}
+	return crc;
+}
+
+static uint8_t frameFinish(uint8_t *frame, uint8_t length)
+{
+	uint16_t crc=frameCrc(frame,length);
+	frame[length]=(uint8_t)crc;
+	frame[length+1]=(uint8_t)(crc>>8);
+	return length+2;
+}
+
+static uint8_t frameValid(const uint8_t *frame, uint16_t length)
+{
+	return (length>=4) && !frameCrc(frame,length);
+}
+
+/*
+*	Collects the characters of the instances, the frame the program has to look at.
+*/
+static void monitor(modbusSimBus *b, const modbusSimChar *c)
+{
+	(void)b;
+	if (c->source<0) return;
+	if (receivedLength<sizeof(received)) received[receivedLength++]=c->received;
+	if (c->collided) receivedBroken=1;
+}
+
+static void busStart(uint32_t baud)
+{
+	modbusSimInit(&bus,baud);
+	bus.monitor=monitor;
+	t35=(baud>19200) ? 1750000 : modbusSimChars(&bus,3.5);
+	t15=(baud>19200) ? 750000 : modbusSimChars(&bus,1.5);
+}
+
+static void printSilence(void)
+{
+	if (!bus.stats.frames || (bus.stats.silenceMin==UINT64_MAX)) {
+		printf("\n");
+		return;
+	}
+	printf(", silence before frames %.2f-%.2fms (T3.5 %.2fms) %s\n",bus.stats.silenceMin/1e6,bus.stats.silenceMax/1e6,t35/1e6,(bus.stats.silenceMin>=t35) ? "ok" : "TOO SHORT");
+}
+
+#ifndef MODBUS_MASTER
+static modbusContext slave[slaves+1];
+static volatile uint16_t holdingRegisters[slaves+1][125];
+
+void modbusGet(modbusContext *ctx)
+{
+	if (modbusCtxGetBusState(ctx) & (1<<ReceiveCompleted))
+	{
+		switch(ctx->buffer[1]) {
+			case fcReadHoldingRegisters:
+			case fcPresetSingleRegister:
+			case fcPresetMultipleRegisters:
+			case fcMaskWriteRegister:
+			case fcReadWriteMultipleRegisters: {
+				modbusCtxExchangeRegisters(ctx,holdingRegisters[ctx-slave],0,125);
+			}
+			break;
+
+			default: {
+				modbusCtxSendException(ctx,ecIllegalFunction);
+			}
+			break;
+		}
+	}
+}
+
+/*
+*	A fresh bus with the slaves 1 to count, the last one with address duplicate if not 0.
+*/
+static void slavesStart(uint8_t count, uint8_t duplicate)
+{
+	busStart(BAUD_SPD);
+	memset(slave,0,sizeof(slave));
+	for (uint8_t c=0; c<count; c++)
+	{
+		modbusCtxSetAddress(&slave[c],(duplicate && (c==count-1)) ? duplicate : c+1);
+		modbusSimAttach(&bus,&slave[c],modbusGet,50000);
+	}
+	modbusSimRun(&bus,ms(10)); //the slaves wait for silence on the bus
+}
+
+/*
+*	Sends frame at time at with gap ns between its characters, waits for the response
+*	(responseTimeout at most) and T3.5 after it.
+*/
+static void request(const uint8_t *frame, uint16_t length, uint64_t at, uint64_t gap)
+{
+	receivedLength=0;
+	receivedBroken=0;
+	uint64_t timeout=modbusSimWrite(&bus,at,frame,length,gap)+responseTimeout;
+	while (!receivedLength && (bus.now<timeout)) modbusSimRun(&bus,bus.now+SIM_TICK);
+	modbusSimRunUntilIdle(&bus,t35,bus.now+ns);
+}
+
+/*
+*	Reads 10 registers of unit, see request. Returns 1 for a proper response.
+*/
+static uint8_t transaction(uint8_t unit, uint64_t at, uint64_t gap)
+{
+	uint8_t frame[8] = { unit, fcReadHoldingRegisters, 0, 0, 0, 10 };
+	request(frame,frameFinish(frame,6),at,gap);
+	return frameValid(received,receivedLength) && (receivedLength==25) && (received[0]==unit) && !receivedBroken;
+}
+
+static void throughput(const char *name, uint32_t noise)
+{
+	uint32_t answered=0, requests=0;
+	slavesStart(slaves,0);
+	modbusSimNoise(&bus,noise,12345);
+	while (bus.now<seconds*ns)
+	{
+		answered+=transaction(requests%slaves+1,bus.now,0);
+		requests++;
+	}
+	printf("%u baud, %s: %.1f transactions/s, %.2f%% without proper response",(unsigned)BAUD_SPD,name,answered/(double)seconds,100.0*(requests-answered)/requests);
+	printSilence();
+}
+
+/*
+*	Gaps in fractions of T3.5 (frames) or T1.5 (characters).
+*/
+static void frameGap(float fraction)
+{
+	uint32_t answered=0;
+	uint64_t gap;
+	slavesStart(1,0);
+	gap=(uint64_t)(fraction*t35);
+	transaction(1,bus.now,0);
+	for (uint8_t c=0; c<100; c++) answered+=transaction(1,bus.lastEnd+gap,0);
+	printf("%u baud, frame gap %.2fms (%.2f T3.5): %u%% answered\n",(unsigned)BAUD_SPD,gap/1e6,fraction,answered);
+}
+
+static void characterGap(float fraction)
+{
+	uint32_t answered=0;
+	uint64_t gap;
+	slavesStart(1,0);
+	gap=(uint64_t)(fraction*t15);
+	for (uint8_t c=0; c<100; c++) answered+=transaction(1,bus.now,gap);
+	printf("%u baud, character gap %.2fms (%.2f T1.5): %u%% answered, %s\n",(unsigned)BAUD_SPD,gap/1e6,fraction,answered,(gap>t15) ? "should be discarded" : "should be answered");
+}
+
+static void overlong(void)
+{
+	uint32_t answered=0;
+	uint8_t garbage[300];
+	slavesStart(1,0);
+	for (uint16_t c=0; c<sizeof(garbage); c++) garbage[c]=(uint8_t)(c*37+11);
+	garbage[0]=1; //for the slave
+	for (uint8_t c=0; c<100; c++)
+	{
+		modbusSimWrite(&bus,bus.now,garbage,sizeof(garbage),0);
+		modbusSimRunUntilIdle(&bus,t35,bus.now+ns);
+		answered+=transaction(1,bus.now,0);
+	}
+	printf("%u baud, overlong frame (%u bytes) followed by a request: %u%% answered\n",(unsigned)BAUD_SPD,(unsigned)sizeof(garbage),answered);
+}
+
+/*
+*	Timer interrupts of a slave on a silent bus, 100us ticks or one-shot expiries.
+*/
+static void idle(void)
+{
+	slavesStart(1,0);
+	bus.stats.timerInterrupts=0;
+	modbusSimRun(&bus,bus.now+ns);
+	printf("%u baud, idle slave: %u timer interrupts/s\n",(unsigned)BAUD_SPD,bus.stats.timerInterrupts);
+}
+
+/*
+*	fcReadWriteMultipleRegisters with read and write quantities and byte counts at and beyond
+*	the limits of the specification, and fcMaskWriteRegister with and without its masks. Each
+*	one has to get the exception code given, 0 for a normal response.
+*/
+static void quantities(void)
+{
+	static const struct { uint16_t read, write; uint8_t bytes, exception; } rw[] = {
+		{ 1, 1, 2, 0 }, { 125, 1, 2, 0 }, { 1, 121, 242, 0 },
+		{ 0, 1, 2, ecIllegalDataValue }, { 126, 1, 2, ecIllegalDataValue },
+		{ 1, 0, 0, ecIllegalDataValue }, { 1, 2, 6, ecIllegalDataValue }, { 1, 2, 2, ecIllegalDataValue }
+	};
+	uint8_t frame[MaxFrameIndex+1], length, right=0, count=0;
+	slavesStart(1,0);
+	for (uint8_t c=0; c<sizeof(rw)/sizeof(rw[0]); c++)
+	{
+		frame[0]=1;
+		frame[1]=fcReadWriteMultipleRegisters;
+		frame[2]=0; frame[3]=0; //read address
+		frame[4]=(uint8_t)(rw[c].read>>8); frame[5]=(uint8_t)rw[c].read;
+		frame[6]=0; frame[7]=0; //write address
+		frame[8]=(uint8_t)(rw[c].write>>8); frame[9]=(uint8_t)rw[c].write;
+		frame[10]=rw[c].bytes;
+		memset(frame+11,0x5a,rw[c].bytes);
+		request(frame,frameFinish(frame,11+rw[c].bytes),bus.now,0);
+		right+=frameValid(received,receivedLength) && (rw[c].exception ? ((received[1]==(fcReadWriteMultipleRegisters|0x80)) && (received[2]==rw[c].exception)) : (received[1]==fcReadWriteMultipleRegisters));
+		count++;
+	}
+	for (uint8_t masks=0; masks<2; masks++)
+	{
+		uint8_t mask[8] = { 1, fcMaskWriteRegister, 0, 0, 0xff, 0x00, 0x00, 0x0f };
+		length=masks ? 8 : 6;
+		memcpy(frame,mask,length);
+		request(frame,frameFinish(frame,length),bus.now,0);
+		right+=frameValid(received,receivedLength) && (masks ? (received[1]==fcMaskWriteRegister) : ((received[1]==(fcMaskWriteRegister|0x80)) && (received[2]==ecIllegalDataValue)));
+		count++;
+	}
+	printf("%u baud, quantity limits of fcReadWriteMultipleRegisters and fcMaskWriteRegister: %u of %u answered right %s\n",(unsigned)BAUD_SPD,right,count,(right==count) ? "ok" : "WRONG");
+}
+
+static void collision(void)
+{
+	uint32_t answered=0;
+	slavesStart(2,1);
+	for (uint8_t c=0; c<100; c++) answered+=transaction(1,bus.now,0);
+	printf("%u baud, two slaves with address 1: %u%% proper responses, %u characters collided\n",(unsigned)BAUD_SPD,answered,bus.stats.collisions);
+}
+
+int main(void)
+{
+	static const float frameGaps[] = { 0.25, 0.5, 0.75, 1.0, 1.25 };
+	static const float characterGaps[] = { 0.5, 1.0, 1.5, 2.0, 3.0 };
+	throughput("throughput",0);
+	for (uint8_t c=0; c<sizeof(frameGaps)/sizeof(frameGaps[0]); c++) frameGap(frameGaps[c]);
+	for (uint8_t c=0; c<sizeof(characterGaps)/sizeof(characterGaps[0]); c++) characterGap(characterGaps[c]);
+	overlong();
+	throughput("noise 1/s",1);
+	throughput("noise 10/s",10);
+	throughput("noise 100/s",100);
+	collision();
+	idle();
+	quantities();
+	return 0;
+}
+#else
+static modbusContext master;
+static uint16_t registers[10];
+static modbusTransaction transaction = { .function = fcReadHoldingRegisters, .address = 0, .amount = 10, .data = registers };
+static uint32_t finished, ok;
+
+void modbusPoll(modbusContext *ctx)
+{
+	if ((transaction.status==TransactionQueued) || (transaction.status==TransactionBusy)) return;
+	if (transaction.slave) {
+		finished++;
+		if (transaction.status==TransactionOk) ok++;
+	}
+	transaction.slave=finished%slaves+1;
+	modbusCtxMasterSubmit(ctx,&transaction);
+}
+
+static void throughput(const char *name, uint32_t noise, uint8_t stray)
+{
+	uint32_t requests=0;
+	busStart(BAUD_SPD);
+	memset(&master,0,sizeof(master));
+	transaction.slave=0;
+	transaction.status=TransactionOk;
+	finished=0;
+	ok=0;
+	modbusSimAttach(&bus,&master,modbusPoll,50000);
+	modbusSimNoise(&bus,noise,12345);
+	receivedLength=0;
+	receivedBroken=0;
+	while (bus.now<seconds*ns)
+	{
+		if (!modbusSimRunUntilIdle(&bus,t35,seconds*ns)) break;
+		if (stray && receivedLength && ((requests++/slaves)&1)) { //no response but a stream of characters up to the timeout
+			uint8_t c=0xff;
+			uint64_t at=bus.now;
+			for (uint16_t n=0; master.masterCurrent && ((n<=MaxFrameIndex+1) || (master.masterTimeout>2*modbusInterFrameDelayReceiveStart)); n++) { //longer than a frame, the master ignores the rest
+				at=modbusSimWrite(&bus,at,&c,1,0);
+				modbusSimRun(&bus,at);
+			}
+			if (master.masterCurrent && (master.masterTimeout>modbusInterFrameDelayReceiveStart)) { //the last one ends about T3.5 before the timeout, at a different phase every time
+				at=modbusSimWrite(&bus,bus.now+(master.masterTimeout-modbusInterFrameDelayReceiveStart)*SIM_TICK-modbusSimChars(&bus,1)-(requests*37000ULL)%SIM_TICK,&c,1,0);
+				modbusSimRun(&bus,at);
+			}
+		} else if (frameValid(received,receivedLength) && !receivedBroken && (received[0]>=1) && (received[0]<=slaves) && (received[1]==fcReadHoldingRegisters)) {
+			uint8_t response[25] = { received[0], fcReadHoldingRegisters, 20 };
+			for (uint8_t c=0; c<20; c++) response[3+c]=c;
+			frameFinish(response,23);
+			modbusSimWrite(&bus,bus.now,response,sizeof(response),0);
+		} else modbusSimRun(&bus,bus.now+SIM_TICK); //nothing to answer
+		receivedLength=0;
+		receivedBroken=0;
+	}
+	printf("%u baud, master, %s: %.1f transactions/s, %.2f%% without proper response",(unsigned)BAUD_SPD,name,ok/(double)seconds,finished ? 100.0*(finished-ok)/finished : 0);
+	printSilence();
+}
+
+int main(void)
+{
+	throughput("throughput",0,0);
+	throughput("noise 1/s",1,0);
+	throughput("noise 10/s",10,0);
+	throughput("noise 100/s",100,0);
+	throughput("stray characters",0,1);
+	return 0;
+}
+#endif
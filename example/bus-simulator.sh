@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+#  Created: 17.10.2026
+#
+#	Runs example/bus-simulator.c for slaves and for a master of this library at
+#	several baud rates, see there for the scenarios. Everything runs in virtual
+#	time on the simulated bus of yaMBSsim.c, the whole run takes a few seconds
+#	and gives the same output every time, so it can be compared with the output
+#	of an earlier version of the library.
+#	Run from the top directory of the library: sh example/bus-simulator.sh
+#	Environment: BAUDS (default "9600 19200 38400 115200"), CFLAGS for the
+#	library, e.g. "-DCRC_MODE=CRC_TABLE". With -DTIMING_MODE=TIMING_ONESHOT or
+#	-DFRAME_END_MODE=FRAME_END_PREDICT or -DFRAME_QUEUE_DEPTH=2 only the slaves
+#	are run, these are slave options.
+
+set -e
+bauds=${BAUDS:-"9600 19200 38400 115200"}
+dir=$(mktemp -d)
+trap 'rm -rf $dir' EXIT
+
+for baud in $bauds
+do
+	gcc -O2 -DMODBUS_HAL=HAL_SIM -DBAUD_SPD=$baud $CFLAGS -I. example/bus-simulator.c yaMBSiavr.c yaMBSsim.c -o $dir/slaves
+	$dir/slaves
+	case "$CFLAGS" in
+		*TIMING_ONESHOT*|*FRAME_END_PREDICT*|*FRAME_QUEUE_DEPTH*) ;;
+		*)
+			gcc -O2 -DMODBUS_HAL=HAL_SIM -DBAUD_SPD=$baud -DMODBUS_MASTER $CFLAGS -I. example/bus-simulator.c yaMBSiavr.c yaMBSsim.c -o $dir/master
+			$dir/master
+		;;
+	esac
+done
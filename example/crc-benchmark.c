@@ -0,0 +1,103 @@
+/*
+ *  Created: 17.10.2026
+ */
+
+/*
+*	Measures the cost of the crc implementation selected by CRC_MODE on the
+*	target itself. Build it once per variant, e.g. with -DCRC_MODE=CRC_TABLE,
+*	-DCRC_MODE=CRC_NIBBLE and -DCRC_MODE=CRC_BITWISE, and compare the results.
+*	Timer1 runs without prescaler, so it counts cpu cycles directly.
+*	The results are served as input registers (client address 0x01):
+*	register 0: CRC_MODE of this build
+*	register 1: cycles for a crc over a full frame (MaxFrameIndex-1 bytes)
+*	register 2: cycles per byte * 16
+*	register 3: cycles for a single crc16Update() call
+*/
+
+#define clientAddress 0x01
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#define F_CPU 20000000
+#include "yaMBSiavr.h"
+
+volatile uint16_t inputRegisters[4];
+
+void timer0100us_start(void) {
+	TCCR0B|=(1<<CS01); //prescaler 8
+	TIMSK0|=(1<<TOIE0);
+}
+
+ISR(TIMER0_OVF_vect) { //this ISR is called 9765.625 times per second
+	modbusTickTimer();
+}
+
+/*
+*	Returns the amount of cycles spent between start and stop, corrected
+*	for the overhead of reading the timer.
+*/
+uint16_t cyclesSince(uint16_t start, uint16_t stop, uint16_t overhead) {
+	return stop-start-overhead;
+}
+
+void benchmark(void) {
+	uint16_t start, stop, overhead;
+	volatile uint16_t sink;
+
+	for (uint16_t c=0; c<=MaxFrameIndex; c++) rxbuffer[c]=(uint8_t)(c*7+3);
+	TCCR1A=0;
+	TCCR1B=(1<<CS10); //no prescaler
+
+	cli();
+	start=TCNT1;
+	stop=TCNT1;
+	overhead=stop-start;
+
+	start=TCNT1;
+	sink=crc16Compute(rxbuffer,MaxFrameIndex-2);
+	stop=TCNT1;
+	inputRegisters[1]=cyclesSince(start,stop,overhead);
+
+	start=TCNT1;
+	sink=crc16Update(sink,rxbuffer[0]);
+	stop=TCNT1;
+	inputRegisters[3]=cyclesSince(start,stop,overhead);
+	sei();
+
+	inputRegisters[0]=CRC_MODE;
+	inputRegisters[2]=(uint16_t)(((uint32_t)inputRegisters[1]*16)/(MaxFrameIndex-1));
+}
+
+void modbusGet(void) {
+	if (modbusGetBusState() & (1<<ReceiveCompleted))
+	{
+		switch(rxbuffer[1]) {
+			case fcReadInputRegisters: {
+				modbusExchangeRegisters(inputRegisters,0,4);
+			}
+			break;
+
+			default: {
+				modbusSendException(ecIllegalFunction);
+			}
+			break;
+		}
+	}
+}
+
+int main(void)
+{
+	benchmark();
+	sei();
+	modbusSetAddress(clientAddress);
+	modbusInit();
+	wdt_enable(7);
+	timer0100us_start();
+
+	while(1)
+	{
+		wdt_reset();
+		modbusGet();
+	}
+}
@@ -0,0 +1,88 @@
+/*
+ *  Created: 17.10.2026
+ */
+
+/*
+*	Firmware for the cycle benchmark under simavr, see example/cycle-benchmark.sh.
+*	A plain slave (client address 0x01) running at 20MHz, like example.c, on
+*	the ATmega328P or ATmega1284P. example/cycle-harness.c sends it scripted
+*	requests through the simulated USART and counts the cycles spent in the
+*	interrupt service routines, in handleRequest and in the library functions
+*	it calls, so keep handleRequest a function of its own.
+*	Baudrate: BAUD_SPD (19200), 8 data bits, 1 stop bit, no parity
+*	coils: 0 to 15
+*	discrete inputs: 0 to 15
+*	input registers: 0 to 9
+*	holding registers: 0 to 9
+*/
+
+#define clientAddress 0x01
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#define F_CPU 20000000
+#include "yaMBSiavr.h"
+
+volatile uint8_t coils[2];
+volatile uint8_t inputs[2] = { 0xa5, 0x3c };
+volatile uint16_t inputRegisters[10];
+volatile uint16_t holdingRegisters[10];
+
+void timer0100us_start(void) {
+	TCCR0B|=(1<<CS01); //prescaler 8
+	TIMSK0|=(1<<TOIE0);
+}
+
+ISR(TIMER0_OVF_vect) { //this ISR is called 9765.625 times per second
+	modbusTickTimer();
+}
+
+void __attribute__((noinline)) handleRequest(void) {
+	switch(rxbuffer[1]) {
+		case fcReadCoilStatus:
+		case fcForceSingleCoil:
+		case fcForceMultipleCoils: {
+			modbusExchangeBits(coils,0,16);
+		}
+		break;
+
+		case fcReadInputStatus: {
+			modbusExchangeBits(inputs,0,16);
+		}
+		break;
+
+		case fcReadHoldingRegisters:
+		case fcPresetSingleRegister:
+		case fcPresetMultipleRegisters: {
+			modbusExchangeRegisters(holdingRegisters,0,10);
+		}
+		break;
+
+		case fcReadInputRegisters: {
+			modbusExchangeRegisters(inputRegisters,0,10);
+		}
+		break;
+
+		default: {
+			modbusSendException(ecIllegalFunction);
+		}
+		break;
+	}
+}
+
+int main(void)
+{
+	for (uint8_t c=0; c<10; c++) inputRegisters[c]=0x1111*c;
+	sei();
+	modbusSetAddress(clientAddress);
+	modbusInit();
+	wdt_enable(7);
+	timer0100us_start();
+
+	while(1)
+	{
+		wdt_reset();
+		if (modbusGetBusState() & (1<<ReceiveCompleted)) handleRequest();
+	}
+}
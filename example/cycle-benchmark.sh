@@ -0,0 +1,46 @@
+#!/bin/sh
+#
+#  Created: 17.10.2026
+#
+#	Counts the cpu cycles the library spends per interrupt and per request on
+#	the ATmega328P and ATmega1284P: builds example/cycle-benchmark.c with
+#	avr-gcc, runs it in simavr with example/cycle-harness.c and prints a tab
+#	separated table (mcu request item calls mean worst), see cycle-harness.c.
+#	Run from the top directory of the library:
+#		sh example/cycle-benchmark.sh > cycles.tsv
+#	Tables of two versions of the library can be compared line by line. There
+#	is no reference table yet: the script and the harness have not been run
+#	against simavr so far, check the first results against a hand count of a
+#	short item (e.g. crc16Update) before relying on them.
+#	Needs avr-gcc, avr-libc, avr-nm and simavr (headers and libsimavr).
+#	Environment: MCUS (default "atmega328p atmega1284p"), AVR_CFLAGS for the
+#	firmware, e.g. "-DCRC_MODE=CRC_TABLE -DCRC_ON_RECEIVE".
+
+set -e
+mcus=${MCUS:-"atmega328p atmega1284p"}
+frequency=20000000
+dir=$(mktemp -d)
+trap 'rm -rf $dir' EXIT
+
+simavr=$(pkg-config --cflags --libs simavr 2>/dev/null || echo "-I/usr/include/simavr -I/usr/local/include/simavr -lsimavr -lelf")
+gcc -O2 example/cycle-harness.c $simavr -o $dir/harness
+
+echo "mcu	request	item	calls	mean	worst" > $dir/cycles.tsv
+for mcu in $mcus
+do
+	avr-gcc -mmcu=$mcu -Os $AVR_CFLAGS -I. example/cycle-benchmark.c yaMBSiavr.c -o $dir/$mcu.elf
+	avr-nm $dir/$mcu.elf > $dir/$mcu.sym
+	vectors=$(printf '#include "yaMBSiavr.h"\nUART_RECEIVE_INTERRUPT UART_TRANSMIT_INTERRUPT UART_TRANSMIT_COMPLETE_INTERRUPT TIMER0_OVF_vect\n' | avr-gcc -mmcu=$mcu -DF_CPU=$frequency $AVR_CFLAGS -I. -E -P -x c - | tail -1)
+	items=""
+	set -- $vectors
+	for item in rx-isr=$1 udre-isr=$2 txc-isr=$3 timer-isr=$4 handleRequest modbusCtxTickTimer crc16Compute crc16Update modbusCtxExchangeRegisters modbusCtxExchangeBits modbusCtxSendException listBitRangeCopy
+	do
+		name=${item%%=*}
+		symbol=${item#*=}
+		address=$(awk -v s="$symbol" '$3==s { print $1 }' $dir/$mcu.sym)
+		[ -n "$address" ] && items="$items $name=$address" #inlined functions have no address
+	done
+	$dir/harness $dir/$mcu.elf $mcu $frequency $items | tail -n +2 >> $dir/cycles.tsv
+done
+
+cat $dir/cycles.tsv
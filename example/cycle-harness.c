@@ -0,0 +1,240 @@
+/*
+ *  Created: 17.10.2026
+ */
+
+/*
+*	Host side of the cycle benchmark, see example/cycle-benchmark.sh, which
+*	builds it against simavr and passes the addresses of the items to measure.
+*	Run:	./cycle-harness firmware.elf mcu frequency [name=address ...]
+*	Runs the firmware (example/cycle-benchmark.c) in simavr, sends it every
+*	request of the script below a number of times through USART0 and checks
+*	the responses. An item is a function or, with a name ending in "-isr", an
+*	interrupt service routine, address is its byte address as printed by
+*	avr-nm. The time from the first instruction of an item up to and including
+*	its ret/reti is counted, i.e. without the call or, for interrupts, the
+*	response time and the jump in the vector table (about 7 cycles). Interrupts
+*	that hit a function are not counted for the function.
+*	Output (stdout), one line per request and item, tab separated:
+*	mcu request item calls mean worst
+*	Request "all" sums up all requests. Item "request" is the total of one
+*	request: the USART interrupts and handleRequest, not the timer interrupt,
+*	which runs whether there are requests or not.
+*/
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_irq.h"
+#include "avr_uart.h"
+
+#define repetitions 20
+#define window 0.05 //seconds of simulated time per request, enough for request and response at 19200
+#define maxItems 16
+#define maxDepth 8
+#define maxFrame 64 //the input fifo of the simulated USART
+
+typedef struct {
+	const char *name;
+	uint8_t unit;
+	uint8_t length;
+	uint8_t pdu[maxFrame];
+} benchmarkRequest;
+
+static const benchmarkRequest script[] = {
+	{ "fc01", 1, 5, { 0x01, 0x00, 0x00, 0x00, 0x10 } },
+	{ "fc02", 1, 5, { 0x02, 0x00, 0x00, 0x00, 0x10 } },
+	{ "fc03", 1, 5, { 0x03, 0x00, 0x00, 0x00, 0x0a } },
+	{ "fc04", 1, 5, { 0x04, 0x00, 0x00, 0x00, 0x0a } },
+	{ "fc05", 1, 5, { 0x05, 0x00, 0x03, 0xff, 0x00 } },
+	{ "fc06", 1, 5, { 0x06, 0x00, 0x01, 0x12, 0x34 } },
+	{ "fc15", 1, 8, { 0x0f, 0x00, 0x00, 0x00, 0x10, 0x02, 0x5a, 0xc3 } },
+	{ "fc16", 1, 26, { 0x10, 0x00, 0x00, 0x00, 0x0a, 0x14, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20 } },
+	{ "exception", 1, 5, { 0x03, 0x00, 0x0a, 0x00, 0x01 } }, //out of range
+	{ "illegal", 1, 1, { 0x41 } },
+	{ "foreign", 2, 5, { 0x03, 0x00, 0x00, 0x00, 0x0a } }, //for another slave, no response
+};
+#define requests (sizeof(script)/sizeof(script[0]))
+
+typedef struct {
+	uint32_t calls;
+	uint64_t sum;
+	uint32_t worst;
+} benchmarkStat;
+
+typedef struct {
+	char name[32];
+	avr_flashaddr_t address;
+	uint8_t isr;
+} benchmarkItem;
+
+typedef struct {
+	uint8_t item;
+	uint16_t sp;
+	avr_cycle_count_t start;
+	avr_cycle_count_t excluded; //cycles of interrupts hitting it
+} benchmarkActive;
+
+static benchmarkItem items[maxItems];
+static uint8_t itemCount;
+static benchmarkActive active[maxDepth];
+static uint8_t depth;
+static benchmarkStat stats[requests+1][maxItems+1]; //row requests: all, column itemCount: request
+static uint64_t requestCycles;
+static uint8_t response[256];
+static uint16_t responseLength;
+
+static void addStat(benchmarkStat *stat, uint64_t cycles)
+{
+	stat->calls++;
+	stat->sum+=cycles;
+	if (cycles>stat->worst) stat->worst=cycles;
+}
+
+static uint16_t crc16(const uint8_t *data, uint16_t length)
+{
+	uint16_t crc=0xffff;
+	while (length--)
+	{
+		crc^=*data++;
+		for (uint8_t b=0; b<8; b++) crc=(crc&1) ? (crc>>1)^0xa001 : crc>>1;
+	}
+	return crc;
+}
+
+static void uartOutput(struct avr_irq_t *irq, uint32_t value, void *param)
+{
+	(void)irq;
+	(void)param;
+	if (responseLength<sizeof(response)) response[responseLength++]=value;
+}
+
+/* @brief: Called after every instruction. Starts the measurement of an item when its first
+*          instruction is reached, finishes it when the stack pointer is back above the return
+*          address. request is the index of the request in script, requests during startup.
+*
+*/
+static void track(avr_t *avr, uint8_t request)
+{
+	uint16_t sp=avr->data[R_SPL]|(avr->data[R_SPH]<<8);
+	while (depth && (sp>active[depth-1].sp))
+	{
+		benchmarkActive *done=&active[--depth];
+		uint64_t cycles=avr->cycle-done->start-done->excluded;
+		if (request<requests) {
+			addStat(&stats[request][done->item],cycles);
+			addStat(&stats[requests][done->item],cycles);
+		}
+		if (items[done->item].isr) {
+			for (uint8_t d=0; d<depth; d++) active[d].excluded+=avr->cycle-done->start;
+		}
+		if (!depth && strcmp(items[done->item].name,"timer-isr")) requestCycles+=cycles;
+	}
+	for (uint8_t c=0; c<itemCount; c++)
+	{
+		if ((avr->pc!=items[c].address) || (depth==maxDepth)) continue;
+		active[depth].item=c;
+		active[depth].sp=sp;
+		active[depth].start=avr->cycle;
+		active[depth].excluded=0;
+		depth++;
+	}
+}
+
+static int run(avr_t *avr, avr_cycle_count_t until, uint8_t request)
+{
+	while (avr->cycle<until)
+	{
+		int state=avr_run(avr);
+		if ((state==cpu_Done) || (state==cpu_Crashed)) return -1;
+		track(avr,request);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	elf_firmware_t firmware;
+	avr_t *avr;
+	avr_irq_t *input;
+	uint32_t flags=0;
+	avr_cycle_count_t cycles;
+	if (argc<4) {
+		fprintf(stderr,"usage: %s firmware.elf mcu frequency [name=address ...]\n",argv[0]);
+		return 1;
+	}
+	for (int c=4; (c<argc) && (itemCount<maxItems); c++)
+	{
+		char *split=strchr(argv[c],'=');
+		if (!split || (split-argv[c]>=(int)sizeof(items[0].name))) continue;
+		memcpy(items[itemCount].name,argv[c],split-argv[c]);
+		items[itemCount].address=strtoul(split+1,0,16);
+		items[itemCount].isr=(strstr(items[itemCount].name,"-isr")!=0);
+		itemCount++;
+	}
+
+	memset(&firmware,0,sizeof(firmware));
+	if (elf_read_firmware(argv[1],&firmware)) {
+		fprintf(stderr,"%s: cannot read the firmware\n",argv[1]);
+		return 1;
+	}
+	strncpy(firmware.mmcu,argv[2],sizeof(firmware.mmcu)-1);
+	firmware.frequency=strtoul(argv[3],0,10);
+	avr=avr_make_mcu_by_name(firmware.mmcu);
+	if (!avr) {
+		fprintf(stderr,"%s: unknown mcu\n",argv[2]);
+		return 1;
+	}
+	avr_init(avr);
+	avr_load_firmware(avr,&firmware);
+	avr->frequency=firmware.frequency;
+	avr_ioctl(avr,AVR_IOCTL_UART_GET_FLAGS('0'),&flags);
+	flags&=~(AVR_UART_FLAG_STDIO|AVR_UART_FLAG_POOL_SLEEP);
+	avr_ioctl(avr,AVR_IOCTL_UART_SET_FLAGS('0'),&flags);
+	avr_irq_register_notify(avr_io_getirq(avr,AVR_IOCTL_UART_GETIRQ('0'),UART_IRQ_OUTPUT),uartOutput,0);
+	input=avr_io_getirq(avr,AVR_IOCTL_UART_GETIRQ('0'),UART_IRQ_INPUT);
+	cycles=(avr_cycle_count_t)(window*avr->frequency);
+
+	if (run(avr,cycles,requests)) return 1; //startup, the slave waits for silence on the bus
+	for (uint8_t n=0; n<repetitions; n++)
+	{
+		for (uint8_t r=0; r<requests; r++)
+		{
+			const benchmarkRequest *request=&script[r];
+			uint8_t frame[maxFrame+3];
+			uint16_t crc;
+			frame[0]=request->unit;
+			memcpy(frame+1,request->pdu,request->length);
+			crc=crc16(frame,request->length+1);
+			frame[request->length+1]=crc&0xff;
+			frame[request->length+2]=crc>>8;
+			for (uint8_t c=0; c<request->length+3; c++) avr_raise_irq(input,frame[c]);
+			responseLength=0;
+			requestCycles=0;
+			if (run(avr,avr->cycle+cycles,r)) {
+				fprintf(stderr,"%s: the firmware stopped\n",request->name);
+				return 1;
+			}
+			if ((request->unit==1) != (responseLength>=5) || (responseLength && crc16(response,responseLength))) {
+				fprintf(stderr,"%s: unexpected response of %u bytes\n",request->name,responseLength);
+				return 1;
+			}
+			addStat(&stats[r][itemCount],requestCycles);
+			addStat(&stats[requests][itemCount],requestCycles);
+		}
+	}
+
+	printf("mcu\trequest\titem\tcalls\tmean\tworst\n");
+	for (uint8_t r=0; r<=requests; r++)
+	{
+		for (uint8_t c=0; c<=itemCount; c++)
+		{
+			benchmarkStat *stat=&stats[r][c];
+			if (!stat->calls) continue;
+			printf("%s\t%s\t%s\t%" PRIu32 "\t%" PRIu64 "\t%" PRIu32 "\n",argv[2],(r<requests) ? script[r].name : "all",(c<itemCount) ? items[c].name : "request",stat->calls,stat->sum/stat->calls,stat->worst);
+		}
+	}
+	return 0;
+}
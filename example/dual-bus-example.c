@@ -0,0 +1,83 @@
+/*
+ *  Created: 17.10.2026
+ */
+
+/*
+*	An example project serving two independent Modbus buses with an
+*	ATmega1284P running at 20MHz, one on each of its USARTs.
+*	Build it and yaMBSiavr.c with -DMODBUS_SECOND_UART
+*	-DSECOND_TRANSCEIVER_ENABLE_PORT=PORTD -DSECOND_TRANSCEIVER_ENABLE_PIN=5
+*	-DSECOND_TRANSCEIVER_ENABLE_PORT_DDR=DDRD (and the definitions for the
+*	first transceiver, TRANSCEIVER_ENABLE_PORT etc.).
+*	Baudrate: 19200, 8 data bits, 1 stop bit, no parity
+*	USART0 (modbusPrimary) answers to client address 0x01 and serves the
+*	holding registers, USART1 (modbusSecondary) answers to client address 0x02
+*	and serves the input registers. A request on one bus never delays the other.
+*/
+
+#define clientAddress1 0x01
+#define clientAddress2 0x02
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#define F_CPU 20000000
+#include "yaMBSiavr.h"
+
+volatile uint16_t holdingRegisters[4];
+volatile uint16_t inputRegisters[4];
+
+void timer0100us_start(void) {
+	TCCR0B|=(1<<CS01); //prescaler 8
+	TIMSK0|=(1<<TOIE0);
+}
+
+ISR(TIMER0_OVF_vect) { //this ISR is called 9765.625 times per second
+	modbusCtxTickTimer(&modbusPrimary);
+	modbusCtxTickTimer(&modbusSecondary);
+}
+
+void modbusGet(modbusContext *bus) {
+	if (modbusCtxGetBusState(bus) & (1<<ReceiveCompleted))
+	{
+		switch(bus->buffer[1]) {
+			case fcReadHoldingRegisters:
+			case fcPresetSingleRegister:
+			case fcPresetMultipleRegisters: {
+				if (bus==&modbusPrimary) modbusCtxExchangeRegisters(bus,holdingRegisters,0,4);
+				else modbusCtxSendException(bus,ecIllegalFunction);
+			}
+			break;
+
+			case fcReadInputRegisters: {
+				if (bus==&modbusSecondary) modbusCtxExchangeRegisters(bus,inputRegisters,0,4);
+				else modbusCtxSendException(bus,ecIllegalFunction);
+			}
+			break;
+
+			default: {
+				modbusCtxSendException(bus,ecIllegalFunction);
+			}
+			break;
+		}
+	}
+}
+
+int main(void)
+{
+	sei();
+	modbusCtxSetAddress(&modbusPrimary,clientAddress1);
+	modbusCtxSetAddress(&modbusSecondary,clientAddress2);
+	modbusCtxInit(&modbusPrimary);
+	modbusCtxInit(&modbusSecondary);
+	wdt_enable(7);
+	timer0100us_start();
+
+	while(1)
+	{
+		wdt_reset();
+		modbusGet(&modbusPrimary);
+		modbusGet(&modbusSecondary);
+		inputRegisters[0]++;
+	}
+}
@@ -112,7 +112,9 @@ void modbusGet(void) {
 			}
 			break;
 			
-			case fcPresetMultipleRegisters: {
+			case fcPresetMultipleRegisters:
+			case fcMaskWriteRegister:
+			case fcReadWriteMultipleRegisters: {
 				modbusExchangeRegisters(holdingRegisters,0,4);
 			}
 			break;
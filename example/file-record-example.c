@@ -0,0 +1,102 @@
+/*
+ *  Created: 17.10.2026
+ */
+
+/*
+*	Bulk transfers with file records (function codes 20 and 21) on an
+*	ATmega88PA running at 20MHz. The master reads and writes whole ranges of
+*	records with a single request, up to 124 registers per frame, instead of
+*	paging through holding registers. The handler moves the data between
+*	rxbuffer and flash or eeprom directly, there is no copy in ram.
+*	Baudrate: 38400, 8 data bits, 1 stop bit, no parity
+*	Your busmaster can read/write the following data:
+*	file 1: calibration table, records 0 to 63, read only (flash)
+*	file 2: event log, records 0 to 199, read and write (eeprom)
+*/
+
+#define clientAddress 0x01
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#define F_CPU 20000000
+#include "yaMBSiavr.h"
+
+#define calibrationFile 1
+#define calibrationRecords 64
+#define logFile 2
+#define logRecords 200
+
+const uint16_t calibration[calibrationRecords] PROGMEM = { 0x0000, 0x0101, 0x0203, 0x0306 }; //and so on
+uint16_t EEMEM eventLog[logRecords];
+
+void timer0100us_start(void) {
+	TCCR0B|=(1<<CS01); //prescaler 8
+	TIMSK0|=(1<<TOIE0);
+}
+
+ISR(TIMER0_OVF_vect) { //this ISR is called 9765.625 times per second
+	modbusTickTimer();
+}
+
+uint8_t fileRecords(uint16_t file, uint16_t record, volatile uint8_t *data, uint8_t length, uint8_t write) {
+	uint16_t value;
+	if ((file==calibrationFile) && !write && (record+length<=calibrationRecords)) {
+		while (length--) {
+			value=pgm_read_word(&calibration[record++]);
+			*data++=value>>8;
+			*data++=value;
+		}
+		return 0;
+	}
+	if ((file==logFile) && (record+length<=logRecords)) {
+		while (length--) {
+			if (write) {
+				value=(data[0]<<8)|data[1];
+				eeprom_update_word(&eventLog[record],value);
+			} else {
+				value=eeprom_read_word(&eventLog[record]);
+				data[0]=value>>8;
+				data[1]=value;
+			}
+			data+=2;
+			record++;
+		}
+		return 0;
+	}
+	return ecIllegalDataAddress;
+}
+
+void modbusGet(void) {
+	if (modbusGetBusState() & (1<<ReceiveCompleted))
+	{
+		switch(rxbuffer[1]) {
+			case fcReadFileRecord:
+			case fcWriteFileRecord: {
+				modbusExchangeFileRecords(fileRecords);
+			}
+			break;
+
+			default: {
+				modbusSendException(ecIllegalFunction);
+			}
+			break;
+		}
+	}
+}
+
+int main(void)
+{
+	sei();
+	modbusSetAddress(clientAddress);
+	modbusInit();
+    wdt_enable(7);
+	timer0100us_start();
+    while(1)
+    {
+		wdt_reset();
+	    modbusGet();
+    }
+}
@@ -0,0 +1,49 @@
+#!/bin/sh
+#
+#  Created: 17.10.2026
+#
+#	Runs example/linux-gateway.c against a simulated slave (example/linux-server.c
+#	on a pseudo terminal) and loads it with example/tcp-benchmark.c:
+#	first a single client, then a greedy client (pipeline depth 8) next to three
+#	clients with a single request at a time. With fair queueing all four get the
+#	same share of the bus and the latency of the modest clients stays low.
+#	Then eight clients poll the same registers, like HMI panels showing the same
+#	values: identical reads share a transaction, and with the response cache
+#	(100ms) the bus only sees about ten reads per second however many clients
+#	ask. The gateway prints the requests it has sent to the bus, the cache hits,
+#	the joined reads and the bus utilisation once a second.
+#	Run from the top directory of the library: sh example/gateway-test.sh
+#	Pseudo terminals transmit instantly, so the time of a transaction is made up
+#	of the silence that ends a frame (request and response) and the processing.
+#	On a real line add the time the characters take at BAUD_SPD.
+
+set -e
+dir=$(mktemp -d)
+trap 'kill $slave $gateway 2>/dev/null; rm -rf $dir' EXIT
+
+gcc -O2 -DMODBUS_HAL=HAL_LINUX -I. example/linux-server.c yaMBSiavr.c yaMBSlinux.c -o $dir/slave
+gcc -O2 -DMODBUS_HAL=HAL_LINUX -DMODBUS_MASTER -DMODBUS_GATEWAY -I. example/linux-gateway.c yaMBSiavr.c yaMBSlinux.c -o $dir/gateway
+gcc -O2 example/tcp-benchmark.c -o $dir/benchmark
+
+$dir/slave > $dir/pty &
+slave=$!
+sleep 0.5
+start_gateway() {
+	kill $gateway 2>/dev/null || true
+	$dir/gateway $(cat $dir/pty) 0 $1 > $dir/port &
+	gateway=$!
+	sleep 0.5
+	port=$(cat $dir/port)
+}
+gateway=
+start_gateway 0
+
+echo "== a single client"
+$dir/benchmark 127.0.0.1 $port 1 1 5
+echo "== a greedy client and three modest ones"
+$dir/benchmark 127.0.0.1 $port 4 1 5 8
+echo "== eight clients reading the same registers"
+$dir/benchmark 127.0.0.1 $port 8 1 5
+echo "== the same with a response cache of 100ms"
+start_gateway 100
+$dir/benchmark 127.0.0.1 $port 8 1 5
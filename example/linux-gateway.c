@@ -0,0 +1,62 @@
+/*
+ *  Created: 17.10.2026
+ */
+
+/*
+*	A Modbus TCP to RTU gateway.
+*	Build:	gcc -O2 -DMODBUS_HAL=HAL_LINUX -DMODBUS_MASTER -DMODBUS_GATEWAY -I. example/linux-gateway.c yaMBSiavr.c yaMBSlinux.c -o linux-gateway
+*	Run:	./linux-gateway /dev/ttyUSB0 [port] [cache]      default port: 1502, cache: 0ms
+*	Baudrate: BAUD_SPD (19200), 8 data bits, 1 stop bit, no parity
+*	Requests of all TCP clients are forwarded to the RTU bus, see
+*	modbusTcpGateway. Once a second the gateway prints the requests it has
+*	forwarded, the ones that failed and the bus utilisation, i.e. the share of
+*	time a transaction was going on. Identical reads of several clients share
+*	one transaction ("joined"), with [cache] > 0 responses to reads are kept
+*	for [cache] milliseconds and answer later reads without the bus ("hits"),
+*	see modbusTcpGatewayCache. See example/gateway-test.sh for a test against
+*	a simulated slave.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "yaMBSlinux.h"
+
+static modbusContext bus;
+static modbusTcpServer gateway;
+
+int main(int argc, char **argv)
+{
+	uint16_t port = (argc>2) ? atoi(argv[2]) : 1502;
+	uint32_t cache = (argc>3) ? atoi(argv[3]) : 0;
+	modbusGatewayStats last = {0};
+	uint64_t lastTime;
+	if (argc<2) {
+		fprintf(stderr,"usage: %s device [port] [cache]\n",argv[0]);
+		return 1;
+	}
+	if (modbusLinuxOpen(&bus,argv[1])<0) {
+		perror(argv[1]);
+		return 1;
+	}
+	if (modbusTcpGateway(&gateway,0,port,&bus)<0) {
+		perror("listen");
+		return 1;
+	}
+	modbusTcpGatewayCache(&gateway,cache*1000,0,0);
+	printf("%u\n",gateway.port);
+	fflush(stdout);
+	lastTime=modbusLinuxMicros();
+
+	while(modbusLinuxPoll(100)>=0)
+	{
+		uint64_t now=modbusLinuxMicros();
+		if (now-lastTime>=1000000)
+		{
+			modbusGatewayStats *stats=&gateway.stats;
+			fprintf(stderr,"%u requests, %u failed, %u cache hits, %u joined, bus utilisation %.1f%%\n",stats->requests-last.requests,stats->failures-last.failures,stats->hits-last.hits,stats->joined-last.joined,(stats->busy-last.busy)*100.0/(now-lastTime));
+			last=*stats;
+			lastTime=now;
+		}
+	}
+	return 1;
+}
@@ -0,0 +1,105 @@
+/*
+ *  Created: 17.10.2026
+ */
+
+/*
+*	The server of example/example.c running on a Linux host instead of an AVR.
+*	Build:	gcc -O2 -DMODBUS_HAL=HAL_LINUX -I. example/linux-server.c yaMBSiavr.c yaMBSlinux.c -o linux-server
+*	Run:	./linux-server /dev/ttyUSB0    serves a serial device
+*		./linux-server                 creates a pseudo terminal and prints the name
+*		                               clients have to connect to
+*	Baudrate: BAUD_SPD (19200), 8 data bits, 1 stop bit, no parity
+*	The process can be run under perf, valgrind --tool=callgrind etc. like
+*	any other program, the core is exactly the one running on the AVR.
+*/
+
+#define clientAddress 0x01
+
+#include <stdio.h>
+#include "yaMBSlinux.h"
+
+volatile uint8_t instate = 0;
+volatile uint8_t outstate = 0;
+volatile uint16_t inputRegisters[4];
+volatile uint16_t holdingRegisters[10];
+
+static modbusContext bus;
+
+void modbusGet(void) {
+	if (modbusCtxGetBusState(&bus) & (1<<ReceiveCompleted))
+	{
+		switch(bus.buffer[1]) {
+			case fcReadCoilStatus: {
+				modbusCtxExchangeBits(&bus,&outstate,0,8);
+			}
+			break;
+
+			case fcReadInputStatus: {
+				volatile uint8_t inps = instate;
+				modbusCtxExchangeBits(&bus,&inps,0,8);
+			}
+			break;
+
+			case fcReadHoldingRegisters: {
+				modbusCtxExchangeRegisters(&bus,holdingRegisters,0,10);
+			}
+			break;
+
+			case fcReadInputRegisters: {
+				modbusCtxExchangeRegisters(&bus,inputRegisters,0,4);
+			}
+			break;
+
+			case fcForceSingleCoil: {
+				modbusCtxExchangeBits(&bus,&outstate,0,8);
+			}
+			break;
+
+			case fcPresetSingleRegister: {
+				modbusCtxExchangeRegisters(&bus,holdingRegisters,0,10);
+			}
+			break;
+
+			case fcForceMultipleCoils: {
+				modbusCtxExchangeBits(&bus,&outstate,0,8);
+			}
+			break;
+
+			case fcPresetMultipleRegisters: {
+				modbusCtxExchangeRegisters(&bus,holdingRegisters,0,10);
+			}
+			break;
+
+			default: {
+				modbusCtxSendException(&bus,ecIllegalFunction);
+			}
+			break;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	char peer[64];
+	modbusCtxSetAddress(&bus,clientAddress);
+	if (argc>1) {
+		if (modbusLinuxOpen(&bus,argv[1])<0) {
+			perror(argv[1]);
+			return 1;
+		}
+	} else {
+		if (modbusLinuxOpenPty(&bus,peer,sizeof(peer))<0) {
+			perror("pty");
+			return 1;
+		}
+		printf("%s\n",peer);
+		fflush(stdout);
+	}
+
+	while(modbusLinuxPoll(100)>=0)
+	{
+		modbusGet();
+		inputRegisters[0]++;
+	}
+	return 1;
+}
@@ -0,0 +1,92 @@
+/*
+ *  Created: 17.10.2026
+ */
+
+/*
+*	The server of example/linux-server.c as a Modbus TCP server.
+*	Build:	gcc -O2 -DMODBUS_HAL=HAL_LINUX -I. example/linux-tcp-server.c yaMBSiavr.c yaMBSlinux.c -o linux-tcp-server
+*	Run:	./linux-tcp-server [port]       default port: 1502
+*	modbusGet is the very same function an RTU main loop would call, it is
+*	called once for every request of every connection. Pass it an RTU
+*	instance as well and both buses serve the same registers.
+*	See example/tcp-benchmark.c for a client measuring requests/s.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "yaMBSlinux.h"
+
+volatile uint8_t instate = 0;
+volatile uint8_t outstate = 0;
+volatile uint16_t inputRegisters[4];
+volatile uint16_t holdingRegisters[10];
+
+static modbusTcpServer server;
+
+void modbusGet(modbusContext *bus) {
+	if (modbusCtxGetBusState(bus) & (1<<ReceiveCompleted))
+	{
+		switch(bus->buffer[1]) {
+			case fcReadCoilStatus: {
+				modbusCtxExchangeBits(bus,&outstate,0,8);
+			}
+			break;
+
+			case fcReadInputStatus: {
+				volatile uint8_t inps = instate;
+				modbusCtxExchangeBits(bus,&inps,0,8);
+			}
+			break;
+
+			case fcReadHoldingRegisters: {
+				modbusCtxExchangeRegisters(bus,holdingRegisters,0,10);
+			}
+			break;
+
+			case fcReadInputRegisters: {
+				inputRegisters[0]++;
+				modbusCtxExchangeRegisters(bus,inputRegisters,0,4);
+			}
+			break;
+
+			case fcForceSingleCoil: {
+				modbusCtxExchangeBits(bus,&outstate,0,8);
+			}
+			break;
+
+			case fcPresetSingleRegister: {
+				modbusCtxExchangeRegisters(bus,holdingRegisters,0,10);
+			}
+			break;
+
+			case fcForceMultipleCoils: {
+				modbusCtxExchangeBits(bus,&outstate,0,8);
+			}
+			break;
+
+			case fcPresetMultipleRegisters: {
+				modbusCtxExchangeRegisters(bus,holdingRegisters,0,10);
+			}
+			break;
+
+			default: {
+				modbusCtxSendException(bus,ecIllegalFunction);
+			}
+			break;
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	uint16_t port = (argc>1) ? atoi(argv[1]) : 1502;
+	if (modbusTcpListen(&server,0,port,modbusGet)<0) {
+		perror("listen");
+		return 1;
+	}
+	printf("%u\n",server.port);
+	fflush(stdout);
+
+	while(modbusLinuxPoll(-1)>=0);
+	return 1;
+}
@@ -0,0 +1,111 @@
+/*
+ *  Created: 17.10.2026
+ */ 
+
+/*
+*	The example of example.c using the C++ front end yaMBSiavr.hpp. Build with
+*	avr-g++ -std=c++11 or later and link against yaMBSiavr.c.
+*	An example project implementing a simple modbus slave device using an
+*	ATmega88PA running at 20MHz.
+*	Baudrate: 38400, 8 data bits, 1 stop bit, no parity
+*	Your busmaster can read/write the following data:
+*	coils: 0 to 7
+*	discrete inputs: 0 to 7
+*	input registers: 0 to 3
+*	holding registers: 0 to 3
+*/
+
+#define clientAddress 0x01
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#define F_CPU 20000000
+#include "yaMBSiavr.hpp"
+
+volatile uint8_t instate = 0;
+volatile uint8_t outstate = 0;
+volatile uint16_t inputRegisters[4];
+volatile uint16_t holdingRegisters[4];
+
+void timer0100us_start(void) {
+	TCCR0B|=(1<<CS01); //prescaler 8
+	TIMSK0|=(1<<TOIE0);
+}
+
+/*
+*   Modify the following 3 functions to implement your own pin configurations...
+*/
+void SetOuts(volatile uint8_t in) {
+	PORTD|= (((in & (1<<3))<<4) | ((in & (1<<4))<<1) | ((in & (1<<5))<<1));
+	PORTB|= (((in & (1<<0))<<2) | ((in & (1<<1))) | ((in & (1<<2))>>2));
+	in=~in;
+	PORTB&= ~(((in & (1<<0))<<2) | ((in & (1<<1))) | ((in & (1<<2))>>2));
+	PORTD&= ~(((in & (1<<3))<<4) | ((in & (1<<4))<<1) | ((in & (1<<5))<<1));
+}
+
+uint8_t ReadIns(void) {
+	uint8_t ins=0x00;
+	ins|=(PINC&((1<<0)|(1<<1)|(1<<2)|(1<<3)|(1<<4)|(1<<5)));
+	ins|=(((PIND&(1<<4))<<2)|((PIND&(1<<3))<<4));
+	return ins;
+}
+
+void io_conf(void) { 
+	/*
+	 Outputs: PB2,PB1,PB0,PD7,PD5,PD6
+	 Inputs: PC0, PC1, PC2, PC3, PC4, PC6, PD4, PD3
+	*/
+	DDRD=0x00;
+	DDRB=0x00;
+	DDRC=0x00;
+	PORTD=0x00;
+	PORTB=0x00;
+	PORTC=0x00;
+	PORTD|=(1<<0);
+	DDRD |= (1<<2)|(1<<5)|(1<<6)|(1<<7);
+	DDRB |= (1<<0)|(1<<1)|(1<<2)|(1<<3);
+}
+
+ISR(TIMER0_OVF_vect) { //this ISR is called 9765.625 times per second
+	modbusTickTimer();
+}
+
+/*
+*	The tables below replace the function code switch of example.c. Discrete inputs
+*	are read from the pins right before the request is answered.
+*/
+volatile uint8_t inps = 0;
+
+typedef yaMBS::Map<
+	yaMBS::Coils<0,8,&outstate>,
+	yaMBS::DiscreteInputs<0,8,&inps>,
+	yaMBS::InputRegisters<0,4,inputRegisters>,
+	yaMBS::HoldingRegisters<0,4,holdingRegisters>
+> RegisterMap;
+
+void modbusGet(void) {
+	if (modbusGetBusState() & (1<<ReceiveCompleted))
+	{
+		inps = ReadIns();
+		if (RegisterMap::handle() && (rxbuffer[1]==fcForceSingleCoil || rxbuffer[1]==fcForceMultipleCoils)) {
+			SetOuts(outstate);
+		}
+	}
+}
+
+int main(void)
+{
+	io_conf();
+	sei();
+	modbusSetAddress(clientAddress);
+	modbusInit();
+    wdt_enable(7);
+	timer0100us_start();
+
+    while(1)
+    {
+		wdt_reset();
+	    modbusGet();
+    }
+}
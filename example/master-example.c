@@ -1,7 +1,7 @@
 /*
  *  Created: 23.03.2019
  *  Author: Max Brueggemann
- */ 
+ */
 
 /*
 *	An example project implementing a modbus master device using an
@@ -9,31 +9,29 @@
 *	Baudrate: 38400, 8 data bits, 1 stop bit, no parity
 *	This code is going to:
 *	1. read holding registers 0 to 3 from client device 1
-*	2. wait 1 second
-*	3. write the value x to register 0 at client device 1
-*	4. increment x
-*	5. wait 1 second
-*	and then start again at 1.
+*	2. write the value x to register 0 at client device 1
+*	3. increment x
+*	and then start again at 1, as fast as the client answers.
+*	Build it and yaMBSiavr.c with -DMODBUS_MASTER.
 */
 
 /*
  *	** A word on the busmaster capabilities of yaMBSiavr **
- *	yaMBSiavr has been solely written to be a modbus server library. 
- *	While it is possible to use it as a modbus master, it cannot be
- *	done without going a little deeper into the modbus protocol.
- *	This example shall serve as a guideline for those who want to do
- *	it anyway :-)
+ *	With MODBUS_MASTER defined, requests are described by a modbusTransaction
+ *	and handed to modbusMasterSubmit. The library sends them one after
+ *	another, matches the responses and handles timeouts in the background,
+ *	so the main loop never has to wait for the bus.
  *
 */
 
-#include <util/delay.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/wdt.h>
 #define F_CPU 20000000
 #include "yaMBSiavr.h"
 
-uint16_t holdingRegisters[4];
+volatile uint16_t holdingRegisters[4];
+volatile uint16_t setpoint = 0;
 
 void timer0100us_start(void) {
 	TCCR0B|=(1<<CS01); //prescaler 8
@@ -44,88 +42,47 @@ ISR(TIMER0_OVF_vect) { //this ISR is called 9765.625 times per second
 	modbusTickTimer();
 }
 
-void readReg(uint8_t slaveid, uint16_t address, uint8_t amount) {
-        _delay_ms(2);
-        rxbuffer[0]=slaveid;
-	modbusSetAddress(slaveid);
-        rxbuffer[1]=0x03;
-        rxbuffer[2]=(address>>8)&0xFF;
-        rxbuffer[3]=address&0xFF;
-        rxbuffer[4]=0x00;
-        rxbuffer[5]=amount;
-        modbusSendMessage(5);
-}
-
-void writeReg(uint8_t slaveid, uint16_t address, uint16_t value) {
-        _delay_ms(2);
-        rxbuffer[0]=slaveid;
-	modbusSetAddress(slaveid);
-        rxbuffer[1]=0x06;
-        rxbuffer[2]=(address>>8)&0xFF;
-        rxbuffer[3]=address&0xFF;
-        rxbuffer[4]=(value>>8)&0xFF;;
-        rxbuffer[5]=value&0xFF;
-        modbusSendMessage(5);
-}
+modbusTransaction readRegs = {
+	.slave = 1,
+	.function = fcReadHoldingRegisters,
+	.address = 0,
+	.amount = 4,
+	.data = holdingRegisters,
+};
 
-#define receiveOkay (modbusGetBusState() & (1<<ReceiveCompleted))
+modbusTransaction writeReg = {
+	.slave = 1,
+	.function = fcPresetSingleRegister,
+	.address = 0,
+	.amount = 1,
+	.data = &setpoint,
+};
 
+#define finished(t) ((t).status!=TransactionQueued && (t).status!=TransactionBusy)
 
 int main(void)
 {
-	sei();
-	modbusSetAddress(1); //better set this to sth.
 	modbusInit();
+	wdt_enable(7);
 	timer0100us_start();
+	sei();
 
     while(1)
     {
 	wdt_reset();
-	_delay_ms(1000);
-
-	/*********************/
-	/*  Read 4 registers */
-	readReg(1,0,4);
-
-	uint8_t breaker = 100;
-	while(!receiveOkay && breaker) { //wait for client response, time out after 1s
-		breaker--;
-		_delay_ms(10);	
-	}
-
-	if(receiveOkay) { //if this fails, there was either no response or a crc error
-		if(rxbuffer[1]&0x80) { //client responded with an error code
-			//handle the error
-		}
-		else {
-			for(uint8_t x=0;x<4;x++) { //rxbuffer[2] should be 8 (4 registers => 8 bytes). You might want to check this at this point.
-				holdingRegisters[x]=(rxbuffer[3+x*2]<<8)+rxbuffer[4+x*2]; //do sth with the acquired data.
-			}
-		}
-
-	}
 
+	if (finished(readRegs) && finished(writeReg)) {
+		if (readRegs.status==TransactionOk) {
+			//do sth with the acquired data in holdingRegisters
+		} else if (readRegs.status==TransactionException) {
+			//the client responded with readRegs.exceptionCode
+		} //else: no response (TransactionTimeout) or a broken one (TransactionInvalid)
 
-	_delay_ms(1000);
-	/*********************/
-	/*  Write 1 register */
-	static uint16_t incr = 0;
-	incr++;
-	writeReg(1,0,incr);
-	
-	breaker = 100;
-	while(!receiveOkay && breaker) { //wait for client response, time out after 1s
-		breaker--;
-		_delay_ms(10);	
+		setpoint++;
+		modbusMasterSubmit(&readRegs);
+		modbusMasterSubmit(&writeReg);
 	}
 
-	if(receiveOkay) { //if this fails, there was either no response or a crc error
-		if(rxbuffer[1]&0x80) { //client responded with an error code
-			//handle the error
-		}
-	}
-	/*******************/
-	
-	
+	/* do your control work here, the bus is served in the background */
     }
 }
@@ -0,0 +1,64 @@
+/*
+ *  Created: 17.10.2026
+ */
+
+/*
+*	An example project implementing a modbus master device that polls
+*	a number of variables on two client devices using an ATmega88PA
+*	running at 20MHz. Build it and yaMBSiavr.c with -DMODBUS_MASTER -DMODBUS_POLL.
+*	Baudrate: 38400, 8 data bits, 1 stop bit, no parity
+*	The first three entries sit close to each other on client device 1 and
+*	are read with a single request (holding registers 0 to 7) every 100ms.
+*	The temperature of client device 1 is too far away and gets its own
+*	request, as does client device 2.
+*/
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#define F_CPU 20000000
+#include "yaMBSiavr.h"
+
+#define ms(x) ((uint32_t)(x)*10) //modbusTickTimer is called every 100us
+
+volatile uint16_t speed[2];
+volatile uint16_t current[2];
+volatile uint16_t status;
+volatile uint16_t temperature;
+volatile uint8_t inputs[2];
+
+modbusPollEntry pollTable[] = {
+	{ .slave = 1, .function = fcReadHoldingRegisters, .address = 0, .amount = 2, .period = ms(100), .data = speed },
+	{ .slave = 1, .function = fcReadHoldingRegisters, .address = 3, .amount = 2, .period = ms(100), .data = current },
+	{ .slave = 1, .function = fcReadHoldingRegisters, .address = 7, .amount = 1, .period = ms(100), .data = &status },
+	{ .slave = 1, .function = fcReadInputRegisters, .address = 100, .amount = 1, .period = ms(1000), .data = &temperature },
+	{ .slave = 2, .function = fcReadInputStatus, .address = 0, .amount = 16, .period = ms(50), .data = inputs },
+};
+
+void timer0100us_start(void) {
+	TCCR0B|=(1<<CS01); //prescaler 8
+	TIMSK0|=(1<<TOIE0);
+}
+
+ISR(TIMER0_OVF_vect) { //this ISR is called 9765.625 times per second
+	modbusTickTimer();
+}
+
+int main(void)
+{
+	modbusInit();
+	wdt_enable(7);
+	timer0100us_start();
+	sei();
+	modbusPollInit(pollTable,sizeof(pollTable)/sizeof(pollTable[0]));
+
+    while(1)
+    {
+	wdt_reset();
+	modbusPollTask();
+
+	if (pollTable[4].status==TransactionOk) {
+		//do sth with inputs
+	}
+    }
+}
@@ -0,0 +1,52 @@
+#!/bin/sh
+#
+#  Created: 17.10.2026
+#
+#	Builds example/example.c with avr-gcc for a couple of MODBUS_FUNCTIONS
+#	configurations and prints a tab separated table of what they take:
+#	mcu config flash ram context rxbuffer
+#	flash is text and data, ram is data and bss of the whole firmware, context
+#	the size of modbusPrimary, most of which is rxbuffer, and rxbuffer
+#	MaxFrameIndex+1, the bytes a frame buffer takes in that configuration (a
+#	read only configuration such as fc3 gets away with 13). Unused functions are
+#	dropped by the linker (-ffunction-sections -Wl,--gc-sections), as they
+#	should be in any build for a small part.
+#	The last row of every mcu is example/map-example.cpp, the same slave written
+#	with the C++ front end yaMBSiavr.hpp, in the default configuration: compare it
+#	with the row "all" to see what the front end costs.
+#	Run from the top directory of the library: sh example/size-report.sh
+#	Needs avr-gcc, avr-g++, avr-libc, avr-size and avr-nm.
+#	Environment: MCUS (default "atmega88pa"), AVR_CFLAGS for all builds, e.g.
+#	"-DCRC_MODE=CRC_TABLE", CONFIGS to replace the configurations below, one
+#	per line: name:flags
+
+set -e
+mcus=${MCUS:-"atmega88pa"}
+configs=${CONFIGS:-"all:
+registers:-DMODBUS_FUNCTIONS=(MODBUS_FC(3)|MODBUS_FC(4)|MODBUS_FC(6)|MODBUS_FC(16)) -DMODBUS_MAX_REGISTERS=4
+fc3:-DMODBUS_FUNCTIONS=(MODBUS_FC(3)) -DMODBUS_MAX_REGISTERS=4"}
+clock=-DF_CPU=20000000 #the clock of the examples, yaMBSiavr.c needs it as well
+dir=$(mktemp -d)
+trap 'rm -rf $dir' EXIT
+
+report() {
+	printf '#include "yaMBSiavr.h"\nuint8_t frameBytes[MaxFrameIndex+1];\n' | avr-gcc -mmcu=$mcu -fno-common $clock $AVR_CFLAGS $1 -I. -c -x c - -o $dir/frame.o
+	buffer=$(avr-nm -S $dir/frame.o | awk '$4=="frameBytes" { print $2 }')
+	set -- $(avr-size --format=berkeley $dir/firmware.elf | tail -1)
+	context=$(avr-nm -S $dir/firmware.elf | awk '$4=="modbusPrimary" { print $2 }')
+	echo "$mcu	$name	$(($1+$2))	$(($2+$3))	$((0x$context))	$((0x$buffer))"
+}
+
+echo "mcu	config	flash	ram	context	rxbuffer"
+for mcu in $mcus
+do
+	echo "$configs" | while IFS=: read name flags
+	do
+		avr-gcc -mmcu=$mcu -Os -ffunction-sections -fdata-sections -Wl,--gc-sections $clock $AVR_CFLAGS $flags -I. example/example.c yaMBSiavr.c -o $dir/firmware.elf
+		report "$flags"
+	done
+	name=map-example.cpp
+	avr-gcc -mmcu=$mcu -Os -ffunction-sections -fdata-sections $clock $AVR_CFLAGS -I. -c yaMBSiavr.c -o $dir/yaMBSiavr.o
+	avr-g++ -mmcu=$mcu -Os -std=c++11 -ffunction-sections -fdata-sections -Wl,--gc-sections $clock $AVR_CFLAGS -I. example/map-example.cpp $dir/yaMBSiavr.o -o $dir/firmware.elf
+	report
+done
@@ -0,0 +1,219 @@
+/*
+ *  Created: 17.10.2026
+ */
+
+/*
+*	Measures the throughput of a Modbus TCP server in requests/s.
+*	Build:	gcc -O2 example/tcp-benchmark.c -o tcp-benchmark
+*	Run:	./tcp-benchmark [host] [port] [connections] [pipeline depth] [seconds] [depth of the first connection]
+*	        defaults: 127.0.0.1 1502 4 8 5 [pipeline depth]
+*	Every connection keeps [pipeline depth] requests on the way (read holding
+*	registers 0 to 9 of unit 1) and checks that every response carries the
+*	transaction identifier of its request. With a depth of 1 the result is
+*	limited by the round trip time, larger depths show what the server itself
+*	is able to do, e.g. against example/linux-tcp-server.c on the same host.
+*	The latency of a request is the time from sending it to the arrival of its
+*	response. A first connection with a larger depth than the others plays a
+*	greedy client, the requests/s of every connection show whether the server
+*	(or gateway, see example/gateway-test.sh) serves them fairly.
+*/
+
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define maxConnections 64
+#define requestLength 12
+#define responseLength 29 //MBAP header, unit, function code, byte count and 10 registers
+#define maxDepth 64
+#define histogramFine 100000 //1us steps up to 100ms, 1ms steps above
+#define histogramSize (histogramFine+100000)
+
+typedef struct {
+	int fd;
+	uint16_t nextSent; //transaction identifier of the next request
+	uint16_t nextReceived; //transaction identifier of the next response
+	uint16_t rxLength;
+	unsigned long responses;
+	double latencySum;
+	double latencyMax;
+	double sent[maxDepth]; //send time by transaction identifier
+	unsigned char rx[4096];
+} connection;
+
+static uint32_t histogram[histogramSize];
+static double maxLatency = 0;
+
+static void recordLatency(double seconds)
+{
+	unsigned long us=seconds*1e6;
+	if (us>=histogramFine) us=histogramFine+(us-histogramFine)/1000;
+	if (us>=histogramSize) us=histogramSize-1;
+	histogram[us]++;
+	if (seconds>maxLatency) maxLatency=seconds;
+}
+
+/*
+*	Returns the latency in ms that fraction of all requests did not exceed.
+*/
+static double percentile(unsigned long total, double fraction)
+{
+	unsigned long sum=0;
+	for (unsigned long c=0; c<histogramSize; c++)
+	{
+		sum+=histogram[c];
+		if (sum>=total*fraction) return (c<histogramFine) ? c/1000.0 : histogramFine/1000.0+(c-histogramFine);
+	}
+	return maxLatency*1000;
+}
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return t.tv_sec+t.tv_nsec*1e-9;
+}
+
+static int connectTo(const char *host, const char *port)
+{
+	struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+	struct addrinfo *list, *ai;
+	int fd=-1;
+	int one=1;
+	if (getaddrinfo(host,port,&hints,&list)) return -1;
+	for (ai=list; ai; ai=ai->ai_next)
+	{
+		fd=socket(ai->ai_family,ai->ai_socktype,ai->ai_protocol);
+		if (fd<0) continue;
+		if (connect(fd,ai->ai_addr,ai->ai_addrlen)==0) break;
+		close(fd);
+		fd=-1;
+	}
+	freeaddrinfo(list);
+	if (fd>=0) setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+	return fd;
+}
+
+/*
+*	Sends amount requests in a single write.
+*/
+static int sendRequests(connection *c, int amount)
+{
+	unsigned char buffer[requestLength*maxDepth];
+	double t=now();
+	for (int n=0; n<amount; n++)
+	{
+		unsigned char *r=buffer+n*requestLength;
+		r[0]=c->nextSent>>8; //transaction identifier
+		r[1]=c->nextSent;
+		r[2]=0; //protocol identifier
+		r[3]=0;
+		r[4]=0; //length
+		r[5]=6;
+		r[6]=1; //unit
+		r[7]=3; //read holding registers
+		r[8]=0; //address
+		r[9]=0;
+		r[10]=0; //amount
+		r[11]=10;
+		c->sent[c->nextSent%maxDepth]=t;
+		c->nextSent++;
+	}
+	return (write(c->fd,buffer,amount*requestLength)==amount*requestLength) ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	const char *host = (argc>1) ? argv[1] : "127.0.0.1";
+	const char *port = (argc>2) ? argv[2] : "1502";
+	int count = (argc>3) ? atoi(argv[3]) : 4;
+	int depth = (argc>4) ? atoi(argv[4]) : 8;
+	double seconds = (argc>5) ? atof(argv[5]) : 5;
+	int firstDepth = (argc>6) ? atoi(argv[6]) : depth;
+	static connection connections[maxConnections];
+	struct pollfd fds[maxConnections];
+	unsigned long responses=0;
+	double start, stop;
+
+	if ((count<1) || (count>maxConnections) || (depth<1) || (depth>maxDepth) || (firstDepth<1) || (firstDepth>maxDepth)) {
+		fprintf(stderr,"1 to %d connections, depth 1 to %d\n",maxConnections,maxDepth);
+		return 1;
+	}
+	for (int c=0; c<count; c++)
+	{
+		connections[c].fd=connectTo(host,port);
+		if (connections[c].fd<0) {
+			perror("connect");
+			return 1;
+		}
+		fds[c].fd=connections[c].fd;
+		fds[c].events=POLLIN;
+	}
+	start=now();
+	stop=start+seconds;
+	for (int c=0; c<count; c++) sendRequests(&connections[c],c ? depth : firstDepth);
+
+	while (now()<stop)
+	{
+		if (poll(fds,count,100)<0) {
+			perror("poll");
+			return 1;
+		}
+		for (int c=0; c<count; c++)
+		{
+			connection *conn=&connections[c];
+			int answered=0;
+			ssize_t n;
+			if (!(fds[c].revents&POLLIN)) continue;
+			n=read(conn->fd,conn->rx+conn->rxLength,sizeof(conn->rx)-conn->rxLength);
+			if (n<=0) {
+				fprintf(stderr,"connection %d closed by the server\n",c);
+				return 1;
+			}
+			conn->rxLength+=n;
+			while (conn->rxLength>=responseLength)
+			{
+				uint16_t tid=(conn->rx[0]<<8)|conn->rx[1];
+				if ((tid!=conn->nextReceived) || (conn->rx[7]!=3) || (conn->rx[8]!=20)) {
+					fprintf(stderr,"unexpected response on connection %d\n",c);
+					return 1;
+				}
+				double latency=now()-conn->sent[tid%maxDepth];
+				recordLatency(latency);
+				conn->latencySum+=latency;
+				if (latency>conn->latencyMax) conn->latencyMax=latency;
+				conn->nextReceived++;
+				memmove(conn->rx,conn->rx+responseLength,conn->rxLength-responseLength);
+				conn->rxLength-=responseLength;
+				answered++;
+			}
+			responses+=answered;
+			conn->responses+=answered;
+			if (answered && (sendRequests(conn,answered)<0)) {
+				perror("write");
+				return 1;
+			}
+		}
+	}
+	stop=now();
+	printf("%d connections, depth %d: %lu requests in %.2fs, %.0f requests/s\n",count,depth,responses,stop-start,responses/(stop-start));
+	printf("latency [ms]: p50 %.3f, p99 %.3f, p99.9 %.3f, max %.3f\n",percentile(responses,0.5),percentile(responses,0.99),percentile(responses,0.999),maxLatency*1000);
+	if (count<=8) {
+		for (int c=0; c<count; c++)
+		{
+			connection *conn=&connections[c];
+			printf("connection %d (depth %d): %.0f requests/s, latency [ms]: mean %.3f, max %.3f\n",c,c ? depth : firstDepth,conn->responses/(stop-start),
+				conn->responses ? conn->latencySum*1000/conn->responses : 0,conn->latencyMax*1000);
+		}
+	}
+	return 0;
+}
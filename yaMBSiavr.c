@@ -42,27 +42,260 @@ THE POSSIBILITY OF SUCH DAMAGE.
                         
 *************************************************************************/
 
-#include <avr/io.h>
 #include "yaMBSiavr.h"
+#include <stddef.h>
+#if MODBUS_HAL == HAL_AVR
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#ifdef MODBUS_EVENTS
+#include <avr/sleep.h>
+#endif
+#if defined(MODBUS_MASTER) || defined(MODBUS_DIAGNOSTICS) || defined(MODBUS_EVENTS) || defined(FRAME_QUEUE_DEPTH) || (FRAME_END_MODE == FRAME_END_PREDICT)
+#include <util/atomic.h>
+#endif
+#else
+/* there are no interrupts to lock out, the backend calls everything from a single thread */
+#define PROGMEM
+#define pgm_read_word(address) (*(address))
+#define cli()
+#define sei()
+#define ATOMIC_BLOCK(type)
+#endif
+
+/*
+* Every ISR works on a fixed instance. Their bodies are inlined, so all accesses to the
+* instance resolve to fixed addresses just like accesses to global variables would.
+*/
+#define ISR_INLINE static inline __attribute__((always_inline))
+
+#if MODBUS_HAL == HAL_AVR
+/*
+* The AVR backend. The ISRs follow further below, behind the parts of the core they call.
+*/
+#if defined(attiny3226_init)
+#define MODBUS_UART_PRIMARY .usart = &UART_N, .baud = BAUD_PRESC
+#else
+#define MODBUS_UART_PRIMARY .data = &UART_DATA, .status = &UART_STATUS, .control = &UART_CONTROL, .format = &UCSRC, .baudHigh = &UBRRH, .baudLow = &UBRRL, .baud = _UBRR
+#endif
+#define MODBUS_UART_SECONDARY .data = &SECOND_UART_DATA, .status = &SECOND_UART_STATUS, .control = &SECOND_UART_CONTROL, .format = &SECOND_UCSRC, .baudHigh = &SECOND_UBRRH, .baudLow = &SECOND_UBRRL, .baud = _UBRR
+#if PHYSICAL_TYPE == 485
+#define MODBUS_UART_TRANSCEIVER(port,ddr,pin) , .txenPort = &(port), .txenDdr = &(ddr), .txenMask = (1<<(pin))
+#else
+#define MODBUS_UART_TRANSCEIVER(port,ddr,pin)
+#endif
+
+modbusContext modbusPrimary = { .uart = { MODBUS_UART_PRIMARY MODBUS_UART_TRANSCEIVER(TRANSCEIVER_ENABLE_PORT,TRANSCEIVER_ENABLE_PORT_DDR,TRANSCEIVER_ENABLE_PIN) } };
+#ifdef MODBUS_SECOND_UART
+modbusContext modbusSecondary = { .uart = { MODBUS_UART_SECONDARY MODBUS_UART_TRANSCEIVER(SECOND_TRANSCEIVER_ENABLE_PORT,SECOND_TRANSCEIVER_ENABLE_PORT_DDR,SECOND_TRANSCEIVER_ENABLE_PIN) } };
+#endif
+
+#if PHYSICAL_TYPE == 485
+static inline void modbusHalTransceiver(modbusContext *ctx, uint8_t transmit)
+{
+	if (transmit) *ctx->uart.txenPort|=ctx->uart.txenMask;
+	else *ctx->uart.txenPort&=~ctx->uart.txenMask;
+}
+#endif
+
+/* @brief: Enables the transmit buffer empty interrupt, the transmit ISR takes over from here.
+*
+*/
+static inline void modbusHalStartTransmit(modbusContext *ctx)
+{
+#if defined(attiny3226_init)
+	ctx->uart.usart->CTRLA |= USART_DREIE_bm;
+#else
+	*ctx->uart.control|=(1<<UART_UDRIE);
+#endif
+}
+
+static void modbusHalInit(modbusContext *ctx)
+{
+#if defined(attiny3226_init) 
+	if (ctx->uart.usart==&UART_N)
+	{
+		TXPORT.DIR |=  (1 << TXPIN);
+		RXPORT.DIR &= ~(1 << RXPIN);
+		UART_PORTMUX &= UART_PORTMUX_AND_MASK;
+		UART_PORTMUX |= UART_PORTMUX_OR_MASK;
+	}
+	ctx->uart.usart->BAUD = ctx->uart.baud;
+	ctx->uart.usart->CTRLA = USART_TXCIE_bm | USART_RXCIE_bm;
+	ctx->uart.usart->CTRLC = USART_CHSIZE_0_bm | USART_CHSIZE_1_bm;
+	ctx->uart.usart->CTRLB = USART_RXEN_bm | USART_TXEN_bm | (UART_DOUBLE_SPEED ? USART_RXMODE_0_bm : 0); //CLK2X
+#else
+	*ctx->uart.baudHigh = (unsigned char)(ctx->uart.baud >> 8);
+	*ctx->uart.baudLow = (unsigned char) ctx->uart.baud;
+	*ctx->uart.status = (UART_DOUBLE_SPEED<<U2X); //double speed mode where it gives the smaller baud error
+#ifdef URSEL   // if UBRRH and UCSRC share the same I/O location , e.g. ATmega8
+	*ctx->uart.format = (1<<URSEL)|(3<<UCSZ0); //Frame Size
+#else
+   *ctx->uart.format = (3<<UCSZ0); //Frame Size
+#endif
+	*ctx->uart.control = (1<<TXCIE)|(1<<RXCIE)|(1<<RXEN)|(1<<TXEN); // USART receiver and transmitter and receive complete interrupt
+#endif
+	#if PHYSICAL_TYPE == 485
+	*ctx->uart.txenDdr|=ctx->uart.txenMask;
+	#endif
+	#if TIMING_MODE == TIMING_ONESHOT
+	TCCR1A=0;
+	TCCR1B=(1<<CS11); //prescaler 8, normal mode: the counter runs freely, interrupts are enabled per instance
+	#endif
+}
+
+#if TIMING_MODE == TIMING_ONESHOT
+#ifdef TIMSK1
+#define TIMER_ONESHOT_MASK TIMSK1
+#define TIMER_ONESHOT_FLAGS TIFR1
+#else
+#define TIMER_ONESHOT_MASK TIMSK
+#define TIMER_ONESHOT_FLAGS TIFR
+#endif
+
+/* @brief: Remembers the counter value the silence is timed from.
+*
+*/
+static inline void modbusHalTimerStart(modbusContext *ctx)
+{
+	uint8_t sreg=SREG;
+	cli(); //TCNT1 is read through the shared TEMP register
+	ctx->uart.timerBase=TCNT1;
+	SREG=sreg;
+}
+
+/* @brief: Sets the output compare of the instance to ticks*100us after timerBase, or disables
+*          it for 0. modbusPrimary uses OCR1A, modbusSecondary OCR1B.
+*
+*/
+static void modbusHalTimerArm(modbusContext *ctx, uint16_t ticks)
+{
+	uint8_t sreg=SREG;
+	uint8_t compare=(1<<OCIE1A);
+	cli();
+#ifdef MODBUS_SECOND_UART
+	if (ctx==&modbusSecondary) {
+		compare=(1<<OCIE1B);
+		if (ticks) OCR1B=ctx->uart.timerBase+ticks*modbusTimerCountsPerTick;
+	} else
+#endif
+	if (ticks) OCR1A=ctx->uart.timerBase+ticks*modbusTimerCountsPerTick;
+	if (ticks) {
+		TIMER_ONESHOT_FLAGS=compare; //clear a stale match
+		TIMER_ONESHOT_MASK|=compare;
+	} else TIMER_ONESHOT_MASK&=~compare;
+	SREG=sreg;
+}
+#endif
+
+#ifdef MODBUS_EVENTS
+/* @brief: Sleeps until the next interrupt. Called with interrupts disabled, returns with
+*          interrupts disabled.
+*
+*/
+static inline void modbusHalIdle(void)
+{
+	sleep_enable();
+	sei(); //the instruction following sei is always executed, no event can get lost in between
+	sleep_cpu();
+	sleep_disable();
+	cli();
+}
+#endif
+#else
+modbusContext modbusPrimary;
+#endif
+
+#ifdef FRAME_QUEUE_DEPTH
+#define modbusRxFrame(ctx) ((ctx)->rxFrame)
+#define modbusRxPos(ctx) ((ctx)->rxPos)
+#define modbusTxFrame(ctx) ((ctx)->txFrame)
+#else
+#define modbusRxFrame(ctx) ((ctx)->buffer)
+#define modbusRxPos(ctx) ((ctx)->dataPos)
+#define modbusTxFrame(ctx) ((ctx)->buffer)
+#endif
+
+#if MODBUS_HAL == HAL_AVR
+#define modbusCrcLength(ctx) 2
+#else
+#define modbusCrcLength(ctx) ((ctx)->framing==FramingTcp?0:2)
+#endif
+#define modbusPduLength(ctx) ((ctx)->dataPos-1-modbusCrcLength(ctx)) //function code and data of the request
+
+#ifdef MODBUS_MASTER
+#define masterIdle 0
+#define masterSending 1
+#define masterWaiting 2
+static void modbusMasterNext(modbusContext *ctx);
+static void modbusMasterResponse(modbusContext *ctx);
+static void modbusMasterTxComplete(modbusContext *ctx);
+static void modbusMasterTick(modbusContext *ctx);
+#endif
+
+#ifdef MODBUS_EVENTS
+void modbusCtxSetEventHandler(modbusContext *ctx, modbusEventHandler handler)
+{
+	ctx->eventHandler = handler;
+}
+
+/* @brief: Posts an event. Called from ISR context only.
+*
+*/
+static inline void modbusPostEvent(modbusContext *ctx, uint8_t event)
+{
+	ctx->events|=(1<<event);
+	if (ctx->eventHandler) ctx->eventHandler(1<<event);
+}
+
+uint8_t modbusCtxGetEvents(modbusContext *ctx)
+{
+	uint8_t events;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		events=ctx->events;
+		ctx->events=0;
+	}
+	return events;
+}
+
+/* @brief: Sleeps with interrupts enabled until an event is pending. Returns with the interrupt
+*          state of the caller.
+*
+*/
+uint8_t modbusCtxWaitForEvent(modbusContext *ctx)
+{
+	uint8_t events;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		while (!ctx->events) modbusHalIdle();
+		events=ctx->events;
+		ctx->events=0;
+	}
+	return events;
+}
+
+void modbusCtxWakeUp(modbusContext *ctx)
+{
+	modbusPostEvent(ctx,EventWakeup);
+}
+#else
+#define modbusPostEvent(ctx,event) ((void)0)
+#endif
 
-volatile unsigned char BusState = 0;
-volatile uint16_t modbusTimer = 0;
-volatile unsigned char rxbuffer[MaxFrameIndex+1];
-volatile uint16_t DataPos = 0;
-volatile unsigned char PacketTopIndex = 7;
-volatile unsigned char modBusStaMaStates = 0;
-volatile uint16_t modbusDataAmount = 0;
-volatile uint16_t modbusDataLocation = 0;
+#ifdef MODBUS_DIAGNOSTICS
+#define modbusCount(ctx,counter) ((ctx)->counters.counter++)
+#else
+#define modbusCount(ctx,counter) ((void)0)
+#endif
 
 /* @brief: save address and amount
 *
 */
-void modbusSaveLocation(void)
+static void modbusSaveLocation(modbusContext *ctx)
 {
-	modbusDataLocation=(rxbuffer[3]|(rxbuffer[2]<<8));
-	if (rxbuffer[1]==fcPresetSingleRegister || rxbuffer[1]==fcForceSingleCoil) modbusDataAmount=1;
-	else modbusDataAmount=(rxbuffer[5]|(rxbuffer[4]<<8));
+	ctx->dataLocation=(ctx->buffer[3]|(ctx->buffer[2]<<8));
+	if (ctx->buffer[1]==fcPresetSingleRegister || ctx->buffer[1]==fcForceSingleCoil || ctx->buffer[1]==fcMaskWriteRegister) ctx->dataAmount=1;
+	else ctx->dataAmount=(ctx->buffer[5]|(ctx->buffer[4]<<8));
 }
 
 /* @brief: returns 1 if data location adr is touched by current command
@@ -70,9 +303,9 @@ void modbusSaveLocation(void)
 *         Arguments: - adr: address of the data object
 *
 */
-uint8_t modbusIsInRange(uint16_t adr)
+uint8_t modbusCtxIsInRange(modbusContext *ctx, uint16_t adr)
 {
-        if((modbusDataLocation <= adr) && (adr<(modbusDataLocation+modbusDataAmount)))
+        if((ctx->dataLocation <= adr) && (adr<(ctx->dataLocation+ctx->dataAmount)))
                 return 1;
         return 0;
 }
@@ -83,42 +316,205 @@ uint8_t modbusIsInRange(uint16_t adr)
 *                    - lastAdr: address of last data object in range
 *
 */
-uint8_t modbusIsRangeInRange(uint16_t startAdr, uint16_t lastAdr)
+uint8_t modbusCtxIsRangeInRange(modbusContext *ctx, uint16_t startAdr, uint16_t lastAdr)
 {
-        if(modbusIsInRange(startAdr) && modbusIsInRange(lastAdr))
+        if(modbusCtxIsInRange(ctx,startAdr) && modbusCtxIsInRange(ctx,lastAdr))
                 return 1;
         return 0;
 }
 
-uint8_t modbusGetBusState(void)
+#ifdef FRAME_QUEUE_DEPTH
+static inline void modbusRxReset(modbusContext *ctx);
+
+uint8_t modbusCtxGetBusState(modbusContext *ctx)
 {
-	return BusState;
+	uint8_t state=ctx->busState;
+	if (!(state&((1<<TransmitRequested)|(1<<Transmitting))) && (ctx->queueHead!=ctx->queueTail))
+	{
+		if (!ctx->queueFrameTaken) { //hand the oldest frame over to the application
+			ctx->queueFrameTaken=1;
+			ctx->dataPos=ctx->frameLength[ctx->queueTail];
+			modbusSaveLocation(ctx);
+		}
+		state|=(1<<ReceiveCompleted);
+	}
+	return state;
 }
 
-#if ADDRESS_MODE == SINGLE_ADR
-volatile unsigned char Address = 0x00;
-uint8_t modbusGetAddress(void)
+/* @brief: Drops the oldest frame from the queue.
+*
+*/
+static void modbusQueueRelease(modbusContext *ctx)
 {
-	return Address;
+	if (ctx->queueHead!=ctx->queueTail)
+	{
+		unsigned char next=(ctx->queueTail+1)%FRAME_QUEUE_DEPTH;
+		ctx->buffer=ctx->queue[next];
+		ctx->queueFrameTaken=0;
+		ctx->queueTail=next;
+	}
 }
 
-void modbusSetAddress(unsigned char newadr)
+/* @brief: Appends the frame that has just been received to the queue and goes on receiving.
+*          The frame is dropped if the queue is full.
+*
+*/
+static inline void modbusFrameReceived(modbusContext *ctx)
+{
+	unsigned char next=(ctx->queueHead+1)%FRAME_QUEUE_DEPTH;
+	if (next!=ctx->queueTail)
+	{
+		ctx->frameLength[ctx->queueHead]=ctx->rxPos;
+		ctx->rxFrame=ctx->queue[next];
+		ctx->queueHead=next;
+		modbusCount(ctx,slaveMessages);
+		modbusPostEvent(ctx,EventFrameReceived);
+	} else {
+		modbusCount(ctx,overflows);
+		modbusPostEvent(ctx,EventError);
+	}
+	modbusRxReset(ctx); //keep receiving
+}
+#else
+uint8_t modbusCtxGetBusState(modbusContext *ctx)
+{
+	return ctx->busState;
+}
+
+static inline void modbusFrameReceived(modbusContext *ctx)
 {
-	Address = newadr;
+	modbusSaveLocation(ctx);
+	ctx->busState=(1<<ReceiveCompleted);
+	modbusCount(ctx,slaveMessages);
+	modbusPostEvent(ctx,EventFrameReceived);
 }
 #endif
 
-#if PHYSICAL_TYPE == 485
-void transceiver_txen(void)
+#if ADDRESS_MODE == SINGLE_ADR
+uint8_t modbusCtxGetAddress(modbusContext *ctx)
 {
-	TRANSCEIVER_ENABLE_PORT|=(1<<TRANSCEIVER_ENABLE_PIN);
+	return ctx->address;
 }
 
- void transceiver_rxen(void)
+void modbusCtxSetAddress(modbusContext *ctx, unsigned char newadr)
 {
-	TRANSCEIVER_ENABLE_PORT&=~(1<<TRANSCEIVER_ENABLE_PIN);
+	ctx->address = newadr;
 }
+#elif defined(ADDRESS_FILTER)
+void modbusCtxSetAddressFilter(modbusContext *ctx, uint8_t adr, uint8_t accept)
+{
+	if (accept) ctx->addressFilter[adr>>3]|=(1<<(adr&7));
+	else ctx->addressFilter[adr>>3]&=~(1<<(adr&7));
+}
+
+uint8_t modbusCtxAddressAccepted(modbusContext *ctx, uint8_t adr)
+{
+	return (ctx->addressFilter[adr>>3]>>(adr&7))&1;
+}
+#endif
+
+/* @brief: 1 if a frame starting with adr is to be received. Otherwise the receive ISR ignores
+*          the rest of the frame and waits for the silence after it, like after an error.
+*
+*/
+static inline uint8_t modbusAcceptFrame(modbusContext *ctx, uint8_t adr)
+{
+#if ADDRESS_MODE == SINGLE_ADR
+	return adr==ctx->address;
+#elif defined(ADDRESS_FILTER)
+	return (ctx->addressFilter[adr>>3]>>(adr&7))&1;
+#else
+	(void)ctx;
+	(void)adr;
+	return 1;
+#endif
+}
+
+#if CRC_MODE == CRC_TABLE
+static const uint16_t crc16Table[256] PROGMEM = {
+	0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+	0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+	0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+	0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+	0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+	0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+	0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+	0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+	0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+	0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+	0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+	0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+	0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+	0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+	0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+	0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+	0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+	0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+	0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+	0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+	0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+	0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+	0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+	0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+	0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+	0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+	0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+	0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+	0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+	0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+	0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+	0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040,
+};
+#elif CRC_MODE == CRC_NIBBLE
+static const uint16_t crc16Table[16] PROGMEM = {
+	0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401,
+	0xA001, 0x6C00, 0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400,
+};
+#endif
+
+/* @brief: Feeds a single byte into a running crc (polynomial 0xA001, reflected).
+*
+*/
+uint16_t crc16Update(uint16_t crc, uint8_t data)
+{
+#if CRC_MODE == CRC_TABLE
+	return (crc >> 8) ^ pgm_read_word(&crc16Table[(uint8_t)crc ^ data]);
+#elif CRC_MODE == CRC_NIBBLE
+	crc ^= data;
+	crc = (crc >> 4) ^ pgm_read_word(&crc16Table[crc & 0x0F]);
+	return (crc >> 4) ^ pgm_read_word(&crc16Table[crc & 0x0F]);
+#else
+	crc ^= data;
+	for (unsigned char n = 0; n < 8; n++) {
+		if (crc & 1) crc = (crc >> 1) ^ 0xA001;
+		else crc >>= 1;
+	}
+	return crc;
 #endif
+}
+
+/* @brief: Returns the crc of ptrToArray[0] to ptrToArray[inputSize].
+*
+*/
+uint16_t crc16Compute(volatile uint8_t *ptrToArray,uint8_t inputSize)
+{
+	uint16_t out=0xffff;
+	uint8_t l=0;
+	do {
+		out=crc16Update(out,ptrToArray[l]);
+	} while (l++ != inputSize);
+	return out;
+}
+
+/* @brief: Appends the crc of ptrToArray[0] to ptrToArray[inputSize] to the array.
+*
+*/
+void crc16Append(volatile uint8_t *ptrToArray,uint8_t inputSize)
+{
+	uint16_t out=crc16Compute(ptrToArray,inputSize);
+	ptrToArray[inputSize+1]=(uint8_t)out; //append Lo
+	ptrToArray[inputSize+2]=(uint8_t)(out>>8); //append Hi
+}
 
 /* @brief: A fairly simple Modbus compliant 16 Bit CRC algorithm.
 *
@@ -128,25 +524,14 @@ void transceiver_txen(void)
 */
 uint8_t crc16(volatile uint8_t *ptrToArray,uint8_t inputSize) //A standard CRC algorithm
 {
-	uint16_t out=0xffff;
-	uint16_t carry;
-	unsigned char n;
+	uint16_t out=crc16Compute(ptrToArray,inputSize);
 	inputSize++;
-	for (int l=0; l<inputSize; l++) {
-		out ^= ptrToArray[l];
-		for (n = 0; n < 8; n++) {
-			carry = out & 1;
-			out >>= 1;
-			if (carry) out ^= 0xA001;
-		}
-	}
-	//out=0x1234;
-	if ((ptrToArray[inputSize]==out%256) && (ptrToArray[inputSize+1]==out/256)) //check
+	if ((ptrToArray[inputSize]==(uint8_t)out) && (ptrToArray[inputSize+1]==(uint8_t)(out>>8))) //check
 	{
 		return 1;
 	} else { 
-		ptrToArray[inputSize]=out%256; //append Lo
-		ptrToArray[inputSize+1]=out/256; //append Hi
+		ptrToArray[inputSize]=(uint8_t)out; //append Lo
+		ptrToArray[inputSize+1]=(uint8_t)(out>>8); //append Hi
 		return 0;	
 	}
 }
@@ -163,300 +548,1656 @@ void listBitCopy(volatile uint8_t *source, uint16_t sourceNr,volatile uint8_t *t
 	} else *(target+(targetNr/8))&=~(1<<(targetNr-((targetNr/8)*8)));
 }
 
-/* @brief: Back to receiving state.
+/* @brief: returns 1 if the received frame is complete and its crc is correct
 *
 */
-void modbusReset(void)
+static inline uint8_t modbusCheckFrame(modbusContext *ctx)
 {
-	BusState=(1<<TimerActive); //stop receiving (error)
-	modbusTimer=0;
+#ifdef CRC_ON_RECEIVE
+	return (modbusRxPos(ctx)>3) && (ctx->rxCrc==0); //the crc over a frame including its own crc is always 0
+#else
+	return (modbusRxPos(ctx)>3) && crc16(modbusRxFrame(ctx),modbusRxPos(ctx)-3); //shorter frames would wrap around
+#endif
 }
 
-void modbusTickTimer(void)
+/* @brief: copies a single bit and advances both bit positions
+*
+*/
+static inline void listBitCopyNext(volatile uint8_t **source, uint8_t *sourceBit, volatile uint8_t **target, uint8_t *targetBit)
 {
-	if (BusState&(1<<TimerActive)) 
-	{
-		modbusTimer++;
-		if (BusState&(1<<Receiving)) //we are in receiving mode
-		{
-			if ((modbusTimer==modbusInterCharTimeout)) {
-				BusState|=(1<<GapDetected);
-			} else if ((modbusTimer==modbusInterFrameDelayReceiveEnd)) { //end of message
-				#if ADDRESS_MODE == MULTIPLE_ADR
-               		 if (crc16(rxbuffer,DataPos-3)) { //perform crc check only. This is for multiple/all address mode.
-				modbusSaveLocation();
-				BusState=(1<<ReceiveCompleted);
-			 } else modbusReset();
-				#endif
-				#if ADDRESS_MODE == SINGLE_ADR
-				if (rxbuffer[0]==Address && crc16(rxbuffer,DataPos-3)) { //is the message for us? => perform crc check
-					modbusSaveLocation();
-					BusState=(1<<ReceiveCompleted);
-				} else modbusReset();
-				#endif
-			}
-		} else if (modbusTimer==modbusInterFrameDelayReceiveStart) BusState|=(1<<BusTimedOut);
+	if (**source&(1<<*sourceBit)) **target|=(1<<*targetBit);
+	else **target&=~(1<<*targetBit);
+	if (++(*sourceBit)==8) {
+		*sourceBit=0;
+		(*source)++;
+	}
+	if (++(*targetBit)==8) {
+		*targetBit=0;
+		(*target)++;
 	}
 }
 
-ISR(UART_RECEIVE_INTERRUPT)
+/* @brief: copies a range of bits from one array of chars to another one. Only the
+*          bits in front of the first and behind the last complete target byte are copied
+*          one by one, everything in between is copied byte-wise.
+*
+*/
+void listBitRangeCopy(volatile uint8_t *source, uint16_t sourceNr, volatile uint8_t *target, uint16_t targetNr, uint16_t amount)
 {
-	unsigned char data;
-#if defined(attiny3226_init)
-	data = UART_N.RXDATAL;
-#else
-	data = UART_DATA;
-#endif
-	modbusTimer=0; //reset timer
-	if (!(BusState & (1<<ReceiveCompleted)) && !(BusState & (1<<TransmitRequested)) && !(BusState & (1<<Transmitting)) && (BusState & (1<<Receiving)) && !(BusState & (1<<BusTimedOut)))
-	{
-		if (DataPos>MaxFrameIndex) 
-		{
-			modbusReset();
+	uint8_t sourceBit=sourceNr&7;
+	uint8_t targetBit=targetNr&7;
+	source+=sourceNr>>3;
+	target+=targetNr>>3;
+	while (amount && targetBit) { //align target
+		listBitCopyNext(&source,&sourceBit,&target,&targetBit);
+		amount--;
+	}
+	if (sourceBit) { //misaligned: merge two source bytes into every target byte
+		uint8_t leftShift=8-sourceBit;
+		while (amount>=8) {
+			*target=(*source>>sourceBit)|(*(source+1)<<leftShift);
+			source++;
+			target++;
+			amount-=8;
 		}
-	    else
-		{
-			rxbuffer[DataPos]=data;
-			DataPos++; //TODO: maybe prevent this from exceeding 255?
-		}	    
-    } 
-	else if (!(BusState & (1<<ReceiveCompleted)) && !(BusState & (1<<TransmitRequested)) && !(BusState & (1<<Transmitting)) && !(BusState & (1<<Receiving)) && (BusState & (1<<BusTimedOut))) 
-	{ 
-		 rxbuffer[0]=data;
-		 BusState=((1<<Receiving)|(1<<TimerActive));
-		 DataPos=1;
-    }
+	} else {
+		while (amount>=8) {
+			*target=*source;
+			source++;
+			target++;
+			amount-=8;
+		}
+	}
+	while (amount) { //remaining bits
+		listBitCopyNext(&source,&sourceBit,&target,&targetBit);
+		amount--;
+	}
 }
 
-ISR(UART_TRANSMIT_INTERRUPT)
+#if TIMING_MODE == TIMING_ONESHOT
+/* @brief: Returns the value of the timer the state machine has to act on next, 0 if none.
+*
+*/
+static inline uint16_t modbusTimerDeadline(modbusContext *ctx)
 {
-	BusState&=~(1<<TransmitRequested);
-	BusState|=(1<<Transmitting);
-#if defined(attiny3226_init)
-	UART_N.TXDATAL=rxbuffer[DataPos];
-#else
-	UART_DATA=rxbuffer[DataPos];
-#endif
-	DataPos++;
-	if (DataPos==(PacketTopIndex+1)) 
-	{
-#if defined(attiny3226_init)
-		UART_N.CTRLA &= ~(USART_DREIE_bm);
-#else
-		UART_CONTROL&=~(1<<UART_UDRIE);
-#endif
-	}
+	if (!(ctx->busState&(1<<TimerActive))) return 0;
+	if (ctx->busState&(1<<Receiving)) return (ctx->timer<modbusInterCharTimeout) ? modbusInterCharTimeout : modbusInterFrameDelayReceiveEnd;
+	if (ctx->timer<modbusInterFrameDelayReceiveStart) return modbusInterFrameDelayReceiveStart;
+	return (ctx->busState&(1<<TransmitHeld)) ? modbusInterFrameDelayReceiveEnd : 0;
 }
 
-ISR(UART_TRANSMIT_COMPLETE_INTERRUPT)
+/* @brief: Arms the timer for the next deadline after a change of state.
+*
+*/
+static inline void modbusTimerArm(modbusContext *ctx)
 {
-	#if PHYSICAL_TYPE == 485
-	transceiver_rxen();
-	#endif
-	modbusReset();
-#if defined(attiny3226_init)
-	UART_N.STATUS |= USART_TXCIF_bm;
-#endif
+	modbusHalTimerArm(ctx,modbusTimerDeadline(ctx));
 }
 
-void modbusInit(void)
+/* @brief: Restarts the silence counted by the timer. Call after the new state has been set.
+*
+*/
+static inline void modbusTimerRestart(modbusContext *ctx)
 {
-#if defined(attiny3226_init) 
-	TXPORT.DIR |=  (1 << TXPIN);
-	RXPORT.DIR &= ~(1 << RXPIN);
-	UART_PORTMUX &= UART_PORTMUX_AND_MASK;
-	UART_PORTMUX |= UART_PORTMUX_OR_MASK;
-	UART_N.BAUD = BAUD_PRESC;
-	UART_N.CTRLA = USART_TXCIE_bm | USART_RXCIE_bm;
-	UART_N.CTRLC = USART_CHSIZE_0_bm | USART_CHSIZE_1_bm;
-	UART_N.CTRLB = USART_RXEN_bm | USART_TXEN_bm | USART_RXMODE_0_bm;
-#else
-	UBRRH = (unsigned char)((_UBRR) >> 8);
-	UBRRL = (unsigned char) _UBRR;
-	UART_STATUS = (1<<U2X); //double speed mode.
-#ifdef URSEL   // if UBRRH and UCSRC share the same I/O location , e.g. ATmega8
-	UCSRC = (1<<URSEL)|(3<<UCSZ0); //Frame Size
+	ctx->timer=0;
+	modbusHalTimerStart(ctx);
+	modbusTimerArm(ctx);
+}
 #else
-   UCSRC = (3<<UCSZ0); //Frame Size
+#define modbusTimerRestart(ctx) ((ctx)->timer=0)
 #endif
-	UART_CONTROL = (1<<TXCIE)|(1<<RXCIE)|(1<<RXEN)|(1<<TXEN); // USART receiver and transmitter and receive complete interrupt
-#endif
-	#if PHYSICAL_TYPE == 485
-	TRANSCEIVER_ENABLE_PORT_DDR|=(1<<TRANSCEIVER_ENABLE_PIN);
-	transceiver_rxen();
-	#endif
-	BusState=(1<<TimerActive);
-}
 
-/* @brief: Sends a response.
+/* @brief: Back to receiving state.
 *
-*         Arguments: - packtop: Position of the last byte containing data.
-*                               modbusSendException is a good usage example.
 */
-void modbusSendMessage(unsigned char packtop)
+#ifdef FRAME_QUEUE_DEPTH
+void modbusCtxReset(modbusContext *ctx)
 {
-	PacketTopIndex=packtop+2;
-	crc16(rxbuffer,packtop);
-	BusState|=(1<<TransmitRequested);
-	DataPos=0;
-	#if PHYSICAL_TYPE == 485
-	transceiver_txen();
-	#endif
-#if defined(attiny3226_init)
-	UART_N.CTRLA |= USART_DREIE_bm;
-#else
-	UART_CONTROL|=(1<<UART_UDRIE);
-#endif
-	BusState&=~(1<<ReceiveCompleted);
+	modbusQueueRelease(ctx);
 }
 
-/* @brief: Sends an exception response.
+/* @brief: Discards the frame being received, a pending transmission is not affected.
 *
-*         Arguments: - exceptionCode
-*                              
 */
-void modbusSendException(unsigned char exceptionCode)
+static inline void modbusRxReset(modbusContext *ctx)
+{
+	ctx->busState=(ctx->busState&((1<<TransmitRequested)|(1<<Transmitting)|(1<<TransmitHeld)))|(1<<TimerActive); //stop receiving (error)
+	modbusTimerRestart(ctx);
+}
+#else
+void modbusCtxReset(modbusContext *ctx)
 {
-	rxbuffer[1]|=(1<<7); //setting MSB of the function code (the exception flag)
-	rxbuffer[2]=exceptionCode; //Exceptioncode. Also the last byte containing data
-	modbusSendMessage(2);
+	ctx->busState=(1<<TimerActive); //stop receiving (error)
+	modbusTimerRestart(ctx);
 }
 
+#define modbusRxReset modbusCtxReset
+#endif
 
-/* @brief:  Returns the amount of requested data objects (coils, discretes, registers)
+/* @brief: Discards a broken frame.
 *
 */
-uint16_t modbusRequestedAmount(void)
+static inline void modbusFrameError(modbusContext *ctx)
 {
-	return modbusDataAmount;
+	modbusPostEvent(ctx,EventError);
+	modbusRxReset(ctx);
 }
 
-/* @brief: Returns the address of the first requested data object (coils, discretes, registers)
+/* @brief: Switches the transceiver to transmit and lets the transmit ISR take over.
 *
 */
-uint16_t modbusRequestedAddress(void)
+static inline void modbusTransmitStart(modbusContext *ctx)
 {
-	return modbusDataLocation;
+	#if PHYSICAL_TYPE == 485
+	modbusHalTransceiver(ctx,1);
+	#endif
+	modbusHalStartTransmit(ctx);
 }
 
-/* @brief: copies a single or multiple bytes from one array of bytes to an array of 16-bit-words
+/* @brief: The timer has reached ctx->timer, acts on the thresholds.
 *
 */
-void intToModbusRegister(volatile uint16_t *inreg, volatile uint8_t *outreg, uint8_t amount)
+static inline void modbusTimerElapsed(modbusContext *ctx)
 {
-	for (uint8_t c=0; c<amount; c++)
+	if (ctx->busState&(1<<Receiving)) //we are in receiving mode
 	{
-			*(outreg+c*2) = (uint8_t)(*(inreg+c) >> 8);
-			*(outreg+1+c*2) = (uint8_t)(*(inreg+c));
+		if ((ctx->timer==modbusInterCharTimeout)) {
+			ctx->busState|=(1<<GapDetected);
+		} else if ((ctx->timer==modbusInterFrameDelayReceiveEnd)) { //end of message
+			#if defined(MODBUS_MASTER)
+			if ((ctx->masterState!=masterWaiting) || !ctx->masterCurrent->slave || (modbusRxFrame(ctx)[0]!=ctx->masterCurrent->slave)) { //not the response we are waiting for
+				modbusRxReset(ctx);
+			} else if (modbusCheckFrame(ctx)) { //perform crc check
+				modbusMasterResponse(ctx);
+			} else {
+				modbusCount(ctx,crcErrors);
+				modbusFrameError(ctx);
+			}
+			#else
+			if (modbusCheckFrame(ctx)) { //perform crc check, the address has been checked by modbusAcceptFrame
+				modbusFrameReceived(ctx);
+			} else {
+				modbusCount(ctx,crcErrors);
+				modbusFrameError(ctx);
+			}
+			#endif
+		}
+	} else if (ctx->timer==modbusInterFrameDelayReceiveStart) {
+		ctx->busState|=(1<<BusTimedOut);
 	}
+	#ifdef MODBUS_MASTER
+	else if (ctx->timer==modbusInterFrameDelayTransmit) { //the start of a frame is accepted earlier, a request waits for T3.5
+		modbusMasterNext(ctx);
+	}
+	#endif
+	#if FRAME_END_MODE == FRAME_END_PREDICT
+	else if ((ctx->timer==modbusInterFrameDelayReceiveEnd) && (ctx->busState&(1<<TransmitHeld))) { //the silence after the request has passed
+		ctx->busState&=~(1<<TransmitHeld);
+		if (ctx->busState&(1<<TransmitRequested)) modbusTransmitStart(ctx);
+	}
+	#endif
+}
+
+#if TIMING_MODE == TIMING_ONESHOT
+void modbusCtxTimerExpired(modbusContext *ctx)
+{
+	uint16_t deadline=modbusTimerDeadline(ctx);
+	if (!deadline) return; //disarmed in the meantime
+	ctx->timer=deadline;
+	modbusTimerElapsed(ctx);
+	modbusTimerArm(ctx);
+}
+#else
+void modbusCtxTickTimer(modbusContext *ctx)
+{
+	#ifdef MODBUS_MASTER
+	ctx->ticks++;
+	#endif
+	if (ctx->busState&(1<<TimerActive)) 
+	{
+		ctx->timer++;
+		modbusTimerElapsed(ctx);
+		#ifdef MODBUS_MASTER
+		modbusMasterTick(ctx);
+		#endif
+	}
+}
+#endif
+
+#if FRAME_END_MODE == FRAME_END_PREDICT
+/* @brief: Hands a request over as soon as its last byte has arrived. The length follows from
+*          the function code and, for writes of multiple objects, the byte count. Frames of other
+*          function codes, and frames that fail the crc, end after silence.
+*
+*/
+ISR_INLINE void modbusPredictFrameEnd(modbusContext *ctx)
+{
+	volatile unsigned char *frame=modbusRxFrame(ctx);
+	modbusFramePos pos=modbusRxPos(ctx);
+	if (pos==2) {
+		switch (frame[1]) {
+			case fcReadCoilStatus:
+			case fcReadInputStatus:
+			case fcReadHoldingRegisters:
+			case fcReadInputRegisters:
+			case fcForceSingleCoil:
+			case fcPresetSingleRegister:
+			case fcDiagnostics: ctx->rxExpected=8; break; //dsReturnQueryData may be longer, it ends after silence then
+			case fcForceMultipleCoils:
+			case fcPresetMultipleRegisters: ctx->rxExpected=7; break; //up to the byte count
+			case fcReportSlaveID: ctx->rxExpected=4; break;
+			case fcReadFileRecord:
+			case fcWriteFileRecord: ctx->rxExpected=3; break; //up to the byte count
+			case fcMaskWriteRegister: ctx->rxExpected=10; break;
+			case fcReadWriteMultipleRegisters: ctx->rxExpected=11; break; //up to the byte count
+			default: ctx->rxExpected=0; break;
+		}
+	} else if (pos!=ctx->rxExpected) {
+		return;
+	} else if ((pos==7) && ((frame[1]==fcForceMultipleCoils) || (frame[1]==fcPresetMultipleRegisters))) {
+		ctx->rxExpected=(frame[6]<=MaxFrameIndex-8) ? 9+frame[6] : 0; //a frame that does not fit ends in an overflow
+	} else if ((pos==3) && ((frame[1]==fcReadFileRecord) || (frame[1]==fcWriteFileRecord))) {
+		ctx->rxExpected=(frame[2]<=MaxFrameIndex-4) ? 5+frame[2] : 0;
+	} else if ((pos==11) && (frame[1]==fcReadWriteMultipleRegisters)) {
+		ctx->rxExpected=(frame[10]<=MaxFrameIndex-12) ? 13+frame[10] : 0;
+	} else if (modbusCheckFrame(ctx)) {
+		modbusFrameReceived(ctx);
+		ctx->busState|=(1<<TransmitHeld)|(1<<TimerActive); //the response waits for the silence, see modbusTimerElapsed
+	}
+}
+#endif
+
+/* @brief: Handles a received byte. Body of the receive ISR.
+*
+*/
+ISR_INLINE void modbusReceiveByte(modbusContext *ctx, unsigned char data)
+{
+	unsigned char state=ctx->busState;
+	ctx->timer=0; //reset timer
+	#ifdef FRAME_QUEUE_DEPTH
+	state&=~((1<<TransmitRequested)|(1<<Transmitting)); //the response is sent from txFrame, receiving goes on into the queue
+	#endif
+	if (!(state & (1<<ReceiveCompleted)) && !(state & (1<<TransmitRequested)) && !(state & (1<<Transmitting)) && (state & (1<<Receiving)) && !(state & (1<<BusTimedOut)))
+	{
+		if (state & (1<<GapDetected)) //more than T1.5 of silence within the frame
+		{
+			modbusCount(ctx,crcErrors);
+			modbusFrameError(ctx);
+		}
+		else if (modbusRxPos(ctx)>MaxFrameIndex) 
+		{
+			modbusCount(ctx,overflows);
+			modbusFrameError(ctx);
+		}
+	    else
+		{
+			modbusRxFrame(ctx)[modbusRxPos(ctx)]=data;
+			modbusRxPos(ctx)++; //TODO: maybe prevent this from exceeding 255?
+			#ifdef CRC_ON_RECEIVE
+			ctx->rxCrc=crc16Update(ctx->rxCrc,data);
+			#endif
+			#if FRAME_END_MODE == FRAME_END_PREDICT
+			modbusPredictFrameEnd(ctx);
+			#endif
+		}	    
+    } 
+	else if (!(state & (1<<ReceiveCompleted)) && !(state & (1<<TransmitRequested)) && !(state & (1<<Transmitting)) && !(state & (1<<Receiving)) && (state & (1<<BusTimedOut))) 
+	{ 
+		 modbusCount(ctx,busMessages);
+		 #ifndef MODBUS_MASTER
+		 if (!modbusAcceptFrame(ctx,data)) {
+			modbusCount(ctx,addressMismatches);
+			modbusRxReset(ctx); //not for us: wait for the silence after the frame
+		 } else
+		 #endif
+		 {
+		 modbusRxFrame(ctx)[0]=data;
+		 #ifdef FRAME_QUEUE_DEPTH
+		 ctx->busState=(ctx->busState&((1<<TransmitRequested)|(1<<Transmitting)|(1<<TransmitHeld)))|(1<<Receiving)|(1<<TimerActive);
+		 #else
+		 ctx->busState=((1<<Receiving)|(1<<TimerActive));
+		 #endif
+		 modbusRxPos(ctx)=1;
+		 #ifdef CRC_ON_RECEIVE
+		 ctx->rxCrc=crc16Update(0xffff,data);
+		 #endif
+		 }
+    }
+	#if TIMING_MODE == TIMING_ONESHOT
+	modbusHalTimerStart(ctx);
+	modbusTimerArm(ctx);
+	#endif
+}
+
+#ifdef ZERO_COPY_TRANSMIT
+/* @brief: Returns the next byte of the frame being sent. The frame consists of two segments,
+*          the header in rxbuffer and the (optional) registers, followed by the crc.
+*
+*/
+ISR_INLINE uint8_t modbusNextTxByte(modbusContext *ctx)
+{
+	uint8_t data;
+	if (ctx->dataPos<=ctx->txHeaderTop) {
+		data=modbusTxFrame(ctx)[ctx->dataPos];
+	} else if (ctx->dataPos<=ctx->txPayloadTop) {
+		uint8_t c=ctx->dataPos-ctx->txHeaderTop-1;
+		uint16_t reg=ctx->txRegisters[c>>1];
+		if (c&1) data=(uint8_t)reg; //Lo
+		else data=(uint8_t)(reg>>8); //Hi
+	} else if (ctx->dataPos==ctx->txPayloadTop+1) {
+		return (uint8_t)ctx->txCrc; //crc Lo
+	} else {
+		return (uint8_t)(ctx->txCrc>>8); //crc Hi
+	}
+	ctx->txCrc=crc16Update(ctx->txCrc,data);
+	return data;
+}
+#endif
+
+/* @brief: Returns the next byte to be sent. Body of the transmit ISR.
+*
+*/
+ISR_INLINE uint8_t modbusTransmitByte(modbusContext *ctx)
+{
+	ctx->busState&=~(1<<TransmitRequested);
+	ctx->busState|=(1<<Transmitting);
+#ifdef ZERO_COPY_TRANSMIT
+	uint8_t data=modbusNextTxByte(ctx);
+#else
+	uint8_t data=modbusTxFrame(ctx)[ctx->dataPos];
+#endif
+	ctx->dataPos++;
+	return data;
+}
+
+/* @brief: returns 1 if the last byte of the frame has been handed to the UART
+*
+*/
+ISR_INLINE uint8_t modbusTransmitDone(modbusContext *ctx)
+{
+	return ctx->dataPos==(ctx->packetTopIndex+1);
+}
+
+/* @brief: The frame has left the transmitter. Body of the transmit complete ISR.
+*
+*/
+ISR_INLINE void modbusTransmitComplete(modbusContext *ctx)
+{
+	#if PHYSICAL_TYPE == 485
+	modbusHalTransceiver(ctx,0);
+	#endif
+#ifdef FRAME_QUEUE_DEPTH
+	ctx->busState&=~((1<<TransmitRequested)|(1<<Transmitting)|(1<<BusTimedOut)); //a frame that is being received goes on
+	if (!(ctx->busState&(1<<Receiving))) modbusTimerRestart(ctx);
+#else
+	modbusCtxReset(ctx);
+#endif
+	modbusPostEvent(ctx,EventFrameSent);
+#ifdef MODBUS_MASTER
+	modbusMasterTxComplete(ctx);
+#endif
+}
+
+#if MODBUS_HAL == HAL_AVR
+#ifdef MODBUS_DIAGNOSTICS
+/* @brief: Counts the errors the UART flags for the byte in its data register. The flags
+*          have to be read before the data register.
+*
+*/
+static inline void modbusUartErrors(modbusContext *ctx, uint8_t framing, uint8_t overrun)
+{
+	if (framing) ctx->counters.framingErrors++;
+	if (overrun) ctx->counters.uartOverruns++;
+}
+#else
+#define modbusUartErrors(ctx,framing,overrun) ((void)0)
+#endif
+
+ISR(UART_RECEIVE_INTERRUPT)
+{
+#if defined(attiny3226_init)
+	modbusUartErrors(&modbusPrimary,UART_N.RXDATAH&USART_FERR_bm,UART_N.RXDATAH&USART_BUFOVF_bm);
+	modbusReceiveByte(&modbusPrimary,UART_N.RXDATAL);
+#else
+	modbusUartErrors(&modbusPrimary,UART_STATUS&(1<<UART_FE),UART_STATUS&(1<<UART_DOR));
+	modbusReceiveByte(&modbusPrimary,UART_DATA);
+#endif
+}
+
+ISR(UART_TRANSMIT_INTERRUPT)
+{
+#if defined(attiny3226_init)
+	UART_N.TXDATAL=modbusTransmitByte(&modbusPrimary);
+	if (modbusTransmitDone(&modbusPrimary)) UART_N.CTRLA &= ~(USART_DREIE_bm);
+#else
+	UART_DATA=modbusTransmitByte(&modbusPrimary);
+	if (modbusTransmitDone(&modbusPrimary)) UART_CONTROL&=~(1<<UART_UDRIE);
+#endif
+}
+
+ISR(UART_TRANSMIT_COMPLETE_INTERRUPT)
+{
+	modbusTransmitComplete(&modbusPrimary);
+#if defined(attiny3226_init)
+	UART_N.STATUS |= USART_TXCIF_bm;
+#endif
+}
+
+#if TIMING_MODE == TIMING_ONESHOT
+ISR(TIMER1_COMPA_vect)
+{
+	modbusCtxTimerExpired(&modbusPrimary);
+}
+#endif
+
+#ifdef MODBUS_SECOND_UART
+ISR(SECOND_UART_RECEIVE_INTERRUPT)
+{
+	modbusUartErrors(&modbusSecondary,SECOND_UART_STATUS&(1<<SECOND_UART_FE),SECOND_UART_STATUS&(1<<SECOND_UART_DOR));
+	modbusReceiveByte(&modbusSecondary,SECOND_UART_DATA);
+}
+
+ISR(SECOND_UART_TRANSMIT_INTERRUPT)
+{
+	SECOND_UART_DATA=modbusTransmitByte(&modbusSecondary);
+	if (modbusTransmitDone(&modbusSecondary)) SECOND_UART_CONTROL&=~(1<<UART_UDRIE);
+}
+
+ISR(SECOND_UART_TRANSMIT_COMPLETE_INTERRUPT)
+{
+	modbusTransmitComplete(&modbusSecondary);
+}
+
+#if TIMING_MODE == TIMING_ONESHOT
+ISR(TIMER1_COMPB_vect)
+{
+	modbusCtxTimerExpired(&modbusSecondary);
+}
+#endif
+#endif
+#else
+void modbusCtxReceiveByte(modbusContext *ctx, uint8_t data)
+{
+	modbusReceiveByte(ctx,data);
+}
+
+uint8_t modbusCtxTransmitByte(modbusContext *ctx)
+{
+	return modbusTransmitByte(ctx);
+}
+
+uint8_t modbusCtxTransmitDone(modbusContext *ctx)
+{
+	return modbusTransmitDone(ctx);
+}
+
+void modbusCtxTransmitComplete(modbusContext *ctx)
+{
+	modbusTransmitComplete(ctx);
+}
+
+void modbusCtxReceiveFrame(modbusContext *ctx, const uint8_t *frame, uint8_t length)
+{
+	for (uint8_t c=0; c<length; c++) modbusRxFrame(ctx)[c]=frame[c];
+	modbusRxPos(ctx)=length;
+	modbusFrameReceived(ctx);
+}
+#endif
+
+void modbusCtxInit(modbusContext *ctx)
+{
+	#ifdef MODBUS_DIAGNOSTICS
+	modbusCtxClearCounters(ctx);
+	#endif
+	modbusHalInit(ctx);
+	#if PHYSICAL_TYPE == 485
+	modbusHalTransceiver(ctx,0);
+	#endif
+#ifdef FRAME_QUEUE_DEPTH
+	ctx->queueHead=0;
+	ctx->queueTail=0;
+	ctx->queueFrameTaken=0;
+	ctx->buffer=ctx->queue[0];
+	ctx->rxFrame=ctx->queue[0];
+#endif
+	ctx->busState=(1<<TimerActive);
+	#if TIMING_MODE == TIMING_ONESHOT
+	modbusTimerRestart(ctx);
+	#endif
+}
+
+#if defined(FRAME_QUEUE_DEPTH) || (FRAME_END_MODE == FRAME_END_PREDICT)
+#define modbusBusStateLock ATOMIC_BLOCK(ATOMIC_RESTORESTATE) //the receive ISR may start the next frame, the timer ISR a held response
+#else
+#define modbusBusStateLock
+#endif
+
+/* @brief: Sends the frame set up in the buffer, with FRAME_END_PREDICT once the silence after
+*          the request has passed. With FRAME_QUEUE_DEPTH the frame is copied to txFrame first
+*          and its queue slot released.
+*
+*/
+static void modbusTransmitRequest(modbusContext *ctx)
+{
+	#ifdef FRAME_QUEUE_DEPTH
+	#ifdef ZERO_COPY_TRANSMIT
+	modbusFramePos length=ctx->txHeaderTop+1; //the registers and the crc follow on the fly
+	#else
+	modbusFramePos length=ctx->packetTopIndex+1;
+	#endif
+	for (modbusFramePos c=0; c<length; c++) ctx->txFrame[c]=ctx->buffer[c];
+	modbusQueueRelease(ctx);
+	#endif
+	modbusBusStateLock
+	{
+		ctx->busState|=(1<<TransmitRequested);
+		if (!(ctx->busState&(1<<TransmitHeld))) modbusTransmitStart(ctx);
+		ctx->busState&=~(1<<ReceiveCompleted);
+	}
+}
+
+#ifdef ZERO_COPY_TRANSMIT
+/* @brief: Sends a response consisting of the header in rxbuffer and registers that are
+*          read directly from the user's array. The crc is calculated on the fly.
+*
+*         Arguments: - packtop: Position of the last header byte in rxbuffer.
+*                    - ptrToRegisters: registers to be sent after the header
+*                    - amount: number of registers
+*/
+void modbusCtxSendRegisters(modbusContext *ctx, unsigned char packtop, volatile uint16_t *ptrToRegisters, uint8_t amount)
+{
+	ctx->txHeaderTop=packtop;
+	ctx->txRegisters=ptrToRegisters;
+	ctx->txPayloadTop=packtop+amount*2;
+	ctx->txCrc=0xffff;
+	ctx->packetTopIndex=ctx->txPayloadTop+modbusCrcLength(ctx);
+	ctx->dataPos=0;
+	modbusTransmitRequest(ctx);
+}
+
+/* @brief: Sends a response.
+*
+*         Arguments: - packtop: Position of the last byte containing data.
+*                               modbusSendException is a good usage example.
+*/
+void modbusCtxSendMessage(modbusContext *ctx, unsigned char packtop)
+{
+	modbusCtxSendRegisters(ctx,packtop,0,0);
+}
+#else
+/* @brief: Sends a response.
+*
+*         Arguments: - packtop: Position of the last byte containing data.
+*                               modbusSendException is a good usage example.
+*/
+void modbusCtxSendMessage(modbusContext *ctx, unsigned char packtop)
+{
+	ctx->packetTopIndex=packtop+modbusCrcLength(ctx);
+	if (modbusCrcLength(ctx)) crc16Append(ctx->buffer,packtop);
+	ctx->dataPos=0;
+	modbusTransmitRequest(ctx);
+}
+#endif
+
+/* @brief: Sends an exception response.
+*
+*         Arguments: - exceptionCode
+*                              
+*/
+void modbusCtxSendException(modbusContext *ctx, unsigned char exceptionCode)
+{
+	ctx->buffer[1]|=(1<<7); //setting MSB of the function code (the exception flag)
+	ctx->buffer[2]=exceptionCode; //Exceptioncode. Also the last byte containing data
+	modbusCount(ctx,exceptions);
+	modbusCtxSendMessage(ctx,2);
+}
+
+
+/* @brief:  Returns the amount of requested data objects (coils, discretes, registers)
+*
+*/
+uint16_t modbusCtxRequestedAmount(modbusContext *ctx)
+{
+	return ctx->dataAmount;
+}
+
+/* @brief: Returns the address of the first requested data object (coils, discretes, registers)
+*
+*/
+uint16_t modbusCtxRequestedAddress(modbusContext *ctx)
+{
+	return ctx->dataLocation;
+}
+
+/* @brief: Returns the amount of registers written by fcReadWriteMultipleRegisters
+*
+*/
+uint16_t modbusCtxRequestedWriteAmount(modbusContext *ctx)
+{
+	return (ctx->buffer[9]|(ctx->buffer[8]<<8));
+}
+
+/* @brief: Returns the address of the first register written by fcReadWriteMultipleRegisters
+*
+*/
+uint16_t modbusCtxRequestedWriteAddress(modbusContext *ctx)
+{
+	return (ctx->buffer[7]|(ctx->buffer[6]<<8));
+}
+
+/* @brief: copies a single or multiple bytes from one array of bytes to an array of 16-bit-words
+*
+*/
+void intToModbusRegister(volatile uint16_t *inreg, volatile uint8_t *outreg, uint8_t amount)
+{
+	for (uint8_t c=0; c<amount; c++)
+	{
+			*(outreg+c*2) = (uint8_t)(*(inreg+c) >> 8);
+			*(outreg+1+c*2) = (uint8_t)(*(inreg+c));
+	}
+}
+
+/* @brief: copies a single or multiple 16-bit-words from one array of integers to an array of bytes
+*
+*/
+void modbusRegisterToInt(volatile uint8_t *inreg, volatile uint16_t *outreg, uint8_t amount)
+{
+	for (uint8_t c=0; c<amount; c++)
+	{
+		*(outreg+c) = (*(inreg+c*2) << 8) + *(inreg+1+c*2);
+	}
+}
+
+
+#if MODBUS_FUNCTIONS != MODBUS_FUNCTIONS_ALL
+/* @brief: Answers function codes left out by MODBUS_FUNCTIONS with ecIllegalFunction and
+*          returns 1 for them.
+*
+*/
+static uint8_t modbusFunctionRefused(modbusContext *ctx)
+{
+	if (modbusFunctionEnabled(ctx->buffer[1])) return 0;
+	modbusCtxSendException(ctx,ecIllegalFunction);
+	return 1;
+}
+#else
+#define modbusFunctionRefused(ctx) 0
+#endif
+
+/* @brief: Answers a register request whose range (both ranges of fcReadWriteMultipleRegisters)
+*          has been checked to lie within ptrToInArray.
+*
+*/
+static uint8_t modbusExchangeRegisterRange(modbusContext *ctx, volatile uint16_t *ptrToInArray, uint16_t startAddress)
+{
+	#if modbusFunctionEnabled(fcReadHoldingRegisters) || modbusFunctionEnabled(fcReadInputRegisters)
+	if ((ctx->buffer[1]==fcReadHoldingRegisters) || (ctx->buffer[1]==fcReadInputRegisters) )
+	{
+		if ((ctx->dataAmount*2)<=(MaxFrameIndex-4)) //message buffer big enough?
+		{
+			ctx->buffer[2]=(unsigned char)(ctx->dataAmount*2);
+			#ifdef ZERO_COPY_TRANSMIT
+			modbusCtxSendRegisters(ctx,2,ptrToInArray+(ctx->dataLocation-startAddress),ctx->dataAmount);
+			#else
+			intToModbusRegister(ptrToInArray+(ctx->dataLocation-startAddress),ctx->buffer+3,ctx->dataAmount);
+			modbusCtxSendMessage(ctx,2+ctx->buffer[2]);
+			#endif
+			return 1;
+		} else modbusCtxSendException(ctx,ecIllegalDataValue);
+		return 0;
+	}
+	#endif
+	#if modbusFunctionEnabled(fcPresetMultipleRegisters)
+	if (ctx->buffer[1]==fcPresetMultipleRegisters)
+	{
+		if (((ctx->buffer[6])>=ctx->dataAmount*2) && ((modbusPduLength(ctx)-6)>=ctx->buffer[6])) //enough data received?
+		{
+			modbusRegisterToInt(ctx->buffer+7,ptrToInArray+(ctx->dataLocation-startAddress),(unsigned char)(ctx->dataAmount));
+			modbusCtxSendMessage(ctx,5);
+			return 1;
+		} else modbusCtxSendException(ctx,ecIllegalDataValue);//too few data bytes received
+		return 0;
+	}
+	#endif
+	#if modbusFunctionEnabled(fcPresetSingleRegister)
+	if (ctx->buffer[1]==fcPresetSingleRegister)
+	{
+		modbusRegisterToInt(ctx->buffer+4,ptrToInArray+(ctx->dataLocation-startAddress),1);
+		modbusCtxSendMessage(ctx,5);
+		return 1;
+	} 
+	#endif
+	#if modbusFunctionEnabled(fcMaskWriteRegister)
+	if (ctx->buffer[1]==fcMaskWriteRegister)
+	{
+		if (modbusPduLength(ctx)>=7) //both masks received?
+		{
+			uint16_t andMask=(ctx->buffer[4]<<8)|ctx->buffer[5];
+			uint16_t orMask=(ctx->buffer[6]<<8)|ctx->buffer[7];
+			volatile uint16_t *reg=ptrToInArray+(ctx->dataLocation-startAddress);
+			*reg=(*reg&andMask)|(orMask&~andMask);
+			modbusCtxSendMessage(ctx,7); //the response echoes the request
+			return 1;
+		} else modbusCtxSendException(ctx,ecIllegalDataValue);
+		return 0;
+	}
+	#endif
+	#if modbusFunctionEnabled(fcReadWriteMultipleRegisters)
+	if (ctx->buffer[1]==fcReadWriteMultipleRegisters)
+	{
+		uint16_t writeLocation=modbusCtxRequestedWriteAddress(ctx);
+		uint16_t writeAmount=modbusCtxRequestedWriteAmount(ctx);
+		if ((ctx->dataAmount>=1) && (ctx->dataAmount<=125) && (writeAmount>=1) && (writeAmount<=121) && (ctx->buffer[10]==writeAmount*2) //the quantities of the specification
+			&& ((ctx->dataAmount*2)<=(MaxFrameIndex-4)) && ((modbusPduLength(ctx)-10)>=ctx->buffer[10])) //response fits, enough data received?
+		{
+			modbusRegisterToInt(ctx->buffer+11,ptrToInArray+(writeLocation-startAddress),(unsigned char)writeAmount); //the write comes first
+			ctx->buffer[2]=(unsigned char)(ctx->dataAmount*2);
+			#ifdef ZERO_COPY_TRANSMIT
+			modbusCtxSendRegisters(ctx,2,ptrToInArray+(ctx->dataLocation-startAddress),ctx->dataAmount);
+			#else
+			intToModbusRegister(ptrToInArray+(ctx->dataLocation-startAddress),ctx->buffer+3,ctx->dataAmount);
+			modbusCtxSendMessage(ctx,2+ctx->buffer[2]);
+			#endif
+			return 1;
+		} else modbusCtxSendException(ctx,ecIllegalDataValue);
+		return 0;
+	}
+	#endif
+	//modbusCtxSendException(ctx,ecSlaveDeviceFailure); //inapropriate call of modbusExchangeRegisters
+	#if !modbusFunctionEnabled(fcReadHoldingRegisters) && !modbusFunctionEnabled(fcReadInputRegisters) && !modbusFunctionEnabled(fcPresetMultipleRegisters) && !modbusFunctionEnabled(fcPresetSingleRegister) && !modbusFunctionEnabled(fcMaskWriteRegister) && !modbusFunctionEnabled(fcReadWriteMultipleRegisters)
+	(void)ctx; //no register function code enabled
+	(void)ptrToInArray;
+	(void)startAddress;
+	#endif
+	return 0;
+}
+
+/* @brief: Handles single/multiple register reading and single/multiple register writing,
+*          masked writes (fcMaskWriteRegister) and combined writes and reads
+*          (fcReadWriteMultipleRegisters, both ranges have to be within the array).
+*
+*         Arguments: - ptrToInArray: pointer to the user's data array containing registers
+*                    - startAddress: address of the first register in the supplied array
+*                    - size: input array size in the requested format (16bit-registers)
+*
+*/
+uint8_t modbusCtxExchangeRegisters(modbusContext *ctx, volatile uint16_t *ptrToInArray, uint16_t startAddress, uint16_t size)
+{
+	if (modbusFunctionRefused(ctx)) return 0;
+	if ((ctx->dataLocation>=startAddress) && ((startAddress+size)>=(ctx->dataAmount+ctx->dataLocation))) {
+		#if modbusFunctionEnabled(fcReadWriteMultipleRegisters)
+		uint16_t writeLocation=modbusCtxRequestedWriteAddress(ctx);
+		if ((ctx->buffer[1]!=fcReadWriteMultipleRegisters) || ((writeLocation>=startAddress) && ((startAddress+size)>=(modbusCtxRequestedWriteAmount(ctx)+writeLocation))))
+		#endif
+		return modbusExchangeRegisterRange(ctx,ptrToInArray,startAddress);
+	}
+	modbusCtxSendException(ctx,ecIllegalDataValue);
+	return 0;
+}
+
+/* @brief: Like modbusCtxExchangeRegisters for a caller that has already checked the requested
+*          range(s) against its array, see yaMBSiavr.hpp.
+*
+*/
+uint8_t modbusCtxExchangeRegistersInRange(modbusContext *ctx, volatile uint16_t *ptrToInArray, uint16_t startAddress)
+{
+	if (modbusFunctionRefused(ctx)) return 0;
+	return modbusExchangeRegisterRange(ctx,ptrToInArray,startAddress);
+}
+
+/* @brief: Answers a bit request whose range has been checked to lie within ptrToInArray.
+*
+*/
+static uint8_t modbusExchangeBitRange(modbusContext *ctx, volatile uint8_t *ptrToInArray, uint16_t startAddress)
+{
+	#if modbusFunctionEnabled(fcReadInputStatus) || modbusFunctionEnabled(fcReadCoilStatus)
+	if ((ctx->buffer[1]==fcReadInputStatus) || (ctx->buffer[1]==fcReadCoilStatus))
+	{
+		if (ctx->dataAmount<=((MaxFrameIndex-4)*8)) //message buffer big enough?
+		{
+			ctx->buffer[2]=(ctx->dataAmount/8);
+			if (ctx->dataAmount%8>0)
+			{
+				ctx->buffer[(uint8_t)(ctx->dataAmount/8)+3]=0x00; //fill last data byte with zeros
+				ctx->buffer[2]++;
+			}
+			listBitRangeCopy(ptrToInArray,ctx->dataLocation-startAddress,ctx->buffer+3,0,ctx->dataAmount);
+			modbusCtxSendMessage(ctx,ctx->buffer[2]+2);
+			return 1;
+		} else modbusCtxSendException(ctx,ecIllegalDataValue); //too many bits requested within single request
+		return 0;
+	}
+	#endif
+	#if modbusFunctionEnabled(fcForceMultipleCoils)
+	if (ctx->buffer[1]==fcForceMultipleCoils)
+	{
+		if (((ctx->buffer[6]*8)>=ctx->dataAmount) && ((modbusPduLength(ctx)-6)>=ctx->buffer[6])) //enough data received?
+		{
+			listBitRangeCopy(ctx->buffer+7,0,ptrToInArray,ctx->dataLocation-startAddress,ctx->dataAmount);
+			modbusCtxSendMessage(ctx,5);
+			return 1;
+		} else modbusCtxSendException(ctx,ecIllegalDataValue);//exception too few data bytes received
+		return 0;
+	}
+	#endif
+	#if modbusFunctionEnabled(fcForceSingleCoil)
+	if (ctx->buffer[1]==fcForceSingleCoil) {
+		listBitRangeCopy(ctx->buffer+4,0,ptrToInArray,ctx->dataLocation-startAddress,1);
+		modbusCtxSendMessage(ctx,5); 
+		return 1;
+	}
+	#endif
+	//modbusCtxSendException(ctx,ecSlaveDeviceFailure); //inanpropriate call of modbusExchangeBits
+	#if !modbusFunctionEnabled(fcReadInputStatus) && !modbusFunctionEnabled(fcReadCoilStatus) && !modbusFunctionEnabled(fcForceMultipleCoils) && !modbusFunctionEnabled(fcForceSingleCoil)
+	(void)ctx; //no bit function code enabled
+	(void)ptrToInArray;
+	(void)startAddress;
+	#endif
+	return 0;
+}
+
+/* @brief: Handles single/multiple input/coil reading and single/multiple coil writing.
+*
+*         Arguments: - ptrToInArray: pointer to the user's data array containing bits
+*                    - startAddress: address of the first bit in the supplied array
+*                    - size: input array size in the requested format (bits)
+*
+*/
+uint8_t modbusCtxExchangeBits(modbusContext *ctx, volatile uint8_t *ptrToInArray, uint16_t startAddress, uint16_t size)
+{
+	if (modbusFunctionRefused(ctx)) return 0;
+	if ((ctx->dataLocation>=startAddress) && ((startAddress+size)>=(ctx->dataAmount+ctx->dataLocation))) return modbusExchangeBitRange(ctx,ptrToInArray,startAddress);
+	modbusCtxSendException(ctx,ecIllegalDataValue);
+	return 0;
+}
+
+/* @brief: Like modbusCtxExchangeBits for a caller that has already checked the requested range
+*          against its array, see yaMBSiavr.hpp.
+*
+*/
+uint8_t modbusCtxExchangeBitsInRange(modbusContext *ctx, volatile uint8_t *ptrToInArray, uint16_t startAddress)
+{
+	if (modbusFunctionRefused(ctx)) return 0;
+	return modbusExchangeBitRange(ctx,ptrToInArray,startAddress);
+}
+
+#if modbusFunctionEnabled(fcReadFileRecord) || modbusFunctionEnabled(fcWriteFileRecord)
+/* @brief: Reads the sub-request (reference type, file, record, length) at frame. Returns its
+*          length in registers, 0 for an invalid reference type or record number.
+*
+*/
+static uint16_t modbusFileSubRequest(volatile uint8_t *frame, uint16_t *file, uint16_t *record)
+{
+	*file=(frame[1]<<8)|frame[2];
+	*record=(frame[3]<<8)|frame[4];
+	if ((frame[0]!=modbusFileReferenceType) || (*record>modbusFileMaxRecord)) return 0;
+	return (frame[5]<<8)|frame[6];
+}
+#endif
+
+/* @brief: Handles file record reading and writing, see modbusFileHandler. Reads are answered
+*          in place, the sub-requests still to be handled are moved up in the buffer whenever
+*          the response would overwrite them.
+*
+*         Arguments: - handler: called once per sub-request (record range)
+*
+*/
+uint8_t modbusCtxExchangeFileRecords(modbusContext *ctx, modbusFileHandler handler)
+{
+	uint16_t file, record, length=0, pos, end;
+	uint8_t exception=0;
+	#if MODBUS_FUNCTIONS != MODBUS_FUNCTIONS_ALL
+	if (!modbusFunctionEnabled(ctx->buffer[1])) {
+		modbusCtxSendException(ctx,ecIllegalFunction);
+		return 0;
+	}
+	#endif
+	if ((ctx->buffer[2]<7) || ((modbusPduLength(ctx)-2)<ctx->buffer[2])) { //too few data bytes received
+		modbusCtxSendException(ctx,ecIllegalDataValue);
+		return 0;
+	}
+	end=3+ctx->buffer[2]; //behind the last sub-request
+	#if modbusFunctionEnabled(fcReadFileRecord)
+	if (ctx->buffer[1]==fcReadFileRecord)
+	{
+		uint16_t next=3, out=3;
+		if (ctx->buffer[2]%7) exception=ecIllegalDataValue;
+		for (pos=3; (pos<end) && !exception; pos+=7) //the response so far and the sub-requests behind it have to fit
+		{
+			length=modbusFileSubRequest(ctx->buffer+pos,&file,&record);
+			out+=2+2*length;
+			if (!length) exception=ecIllegalDataAddress;
+			else if ((length>MaxFrameIndex/2) || ((out+end-pos-7)>(MaxFrameIndex+1))) exception=ecIllegalDataValue;
+		}
+		if (!exception && (out>(MaxFrameIndex-1))) exception=ecIllegalDataValue; //no room for the crc
+		out=3;
+		while (!exception && (next<end))
+		{
+			length=modbusFileSubRequest(ctx->buffer+next,&file,&record);
+			next+=7;
+			if ((next<end) && ((out+2+2*length)>next)) {
+				for (pos=end-next; pos--; ) ctx->buffer[out+2+2*length+pos]=ctx->buffer[next+pos];
+				end+=out+2+2*length-next;
+				next=out+2+2*length;
+			}
+			ctx->buffer[out]=(unsigned char)(1+2*length);
+			ctx->buffer[out+1]=modbusFileReferenceType;
+			exception=handler(file,record,ctx->buffer+out+2,(uint8_t)length,0);
+			out+=2+2*length;
+		}
+		if (!exception) {
+			ctx->buffer[2]=(unsigned char)(out-3);
+			modbusCtxSendMessage(ctx,out-1);
+			return 1;
+		}
+	}
+	#endif
+	#if modbusFunctionEnabled(fcWriteFileRecord)
+	if (ctx->buffer[1]==fcWriteFileRecord)
+	{
+		for (pos=3; ((pos+7)<=end) && !exception; pos+=7+2*length)
+		{
+			length=modbusFileSubRequest(ctx->buffer+pos,&file,&record);
+			if (!length) exception=ecIllegalDataAddress;
+			else if (length>MaxFrameIndex/2) exception=ecIllegalDataValue;
+		}
+		if (!exception && (pos!=end)) exception=ecIllegalDataValue; //the byte count does not match the sub-requests
+		for (pos=3; (pos<end) && !exception; pos+=7+2*length)
+		{
+			length=modbusFileSubRequest(ctx->buffer+pos,&file,&record);
+			exception=handler(file,record,ctx->buffer+pos+7,(uint8_t)length,1);
+		}
+		if (!exception) {
+			modbusCtxSendMessage(ctx,end-1); //the response echoes the request
+			return 1;
+		}
+	}
+	#endif
+	#if !modbusFunctionEnabled(fcReadFileRecord) && !modbusFunctionEnabled(fcWriteFileRecord)
+	(void)handler; //no file record function code enabled
+	(void)file; (void)record; (void)length; (void)pos; (void)end;
+	#endif
+	if (exception) modbusCtxSendException(ctx,exception);
+	return 0;
+}
+
+#ifdef MODBUS_DIAGNOSTICS
+void modbusCtxGetCounters(modbusContext *ctx, modbusCounters *counters)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		*counters=ctx->counters;
+	}
+}
+
+void modbusCtxClearCounters(modbusContext *ctx)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		ctx->counters=(modbusCounters){0};
+	}
+}
+
+/* @brief: Answers fcDiagnostics, see modbusDiagnostics.
+*
+*/
+uint8_t modbusCtxDiagnostics(modbusContext *ctx)
+{
+	modbusCounters counters;
+	uint16_t value;
+	#if MODBUS_FUNCTIONS != MODBUS_FUNCTIONS_ALL
+	if (!modbusFunctionEnabled(fcDiagnostics)) {
+		modbusCtxSendException(ctx,ecIllegalFunction);
+		return 0;
+	}
+	#endif
+	if (modbusPduLength(ctx)<5) { //sub-function and data
+		modbusCtxSendException(ctx,ecIllegalDataValue);
+		return 0;
+	}
+	modbusCtxGetCounters(ctx,&counters);
+	switch ((ctx->buffer[2]<<8)|ctx->buffer[3]) {
+		case dsReturnQueryData: {
+			modbusCtxSendMessage(ctx,modbusPduLength(ctx)); //the response echoes the request
+		}
+		return 1;
+
+		case dsRestartCommunications:
+		case dsClearCounters: {
+			modbusCtxClearCounters(ctx);
+			modbusCtxSendMessage(ctx,5);
+		}
+		return 1;
+
+		case dsBusMessageCount: value=counters.busMessages; break;
+		case dsBusCommunicationErrorCount: value=counters.crcErrors; break;
+		case dsBusExceptionErrorCount: value=counters.exceptions; break;
+		case dsSlaveMessageCount: value=counters.slaveMessages; break;
+		case dsBusCharacterOverrunCount: value=counters.overflows+counters.uartOverruns; break;
+
+		default: {
+			modbusCtxSendException(ctx,ecIllegalFunction);
+		}
+		return 0;
+	}
+	if (ctx->buffer[4] || ctx->buffer[5]) { //the data field of the counters has to be 0
+		modbusCtxSendException(ctx,ecIllegalDataValue);
+		return 0;
+	}
+	ctx->buffer[4]=(unsigned char)(value>>8);
+	ctx->buffer[5]=(unsigned char)value;
+	modbusCtxSendMessage(ctx,5);
+	return 1;
+}
+#endif
+
+
+#ifdef MODBUS_MASTER
+/* @brief: returns 1 if the bus has been silent for at least 3.5 characters. BusTimedOut alone
+*          is set a tick earlier (see modbusInterFrameDelayReceiveStart), the timer decides.
+*
+*/
+static inline uint8_t modbusBusIdle(modbusContext *ctx)
+{
+	return (ctx->busState&(1<<BusTimedOut)) && !(ctx->busState&((1<<Receiving)|(1<<TransmitRequested)|(1<<Transmitting))) && (ctx->timer>=modbusInterFrameDelayTransmit);
+}
+
+/* @brief: Builds the request of transaction t in rxbuffer and sends it. Returns 0 if the
+*          request is invalid, exceeds the quantity the specification allows or does not
+*          fit into rxbuffer.
+*
+*/
+static uint8_t modbusMasterSend(modbusContext *ctx, modbusTransaction *t)
+{
+	unsigned char packtop=5;
+	uint8_t bytes;
+	ctx->buffer[0]=t->slave;
+	ctx->buffer[1]=t->function;
+	ctx->buffer[2]=(uint8_t)(t->address>>8);
+	ctx->buffer[3]=(uint8_t)t->address;
+	ctx->buffer[4]=(uint8_t)(t->amount>>8);
+	ctx->buffer[5]=(uint8_t)t->amount;
+	#ifdef MODBUS_GATEWAY
+	if (t->raw) {
+		if (t->amount>MaxFrameIndex-3) return 0;
+		for (uint8_t c=0; c<t->amount; c++) ctx->buffer[2+c]=((volatile uint8_t *)t->data)[c];
+		modbusCtxSendMessage(ctx,1+t->amount);
+		return 1;
+	}
+	#endif
+	switch (t->function)
+	{
+		case fcReadCoilStatus:
+		case fcReadInputStatus:
+			if (!t->amount || (t->amount>2000) || (t->amount>((MaxFrameIndex-4)*8))) return 0; //response would not fit
+			break;
+
+		case fcReadHoldingRegisters:
+		case fcReadInputRegisters:
+			if (!t->amount || (t->amount>125) || (t->amount>((MaxFrameIndex-4)/2))) return 0; //response would not fit
+			break;
+
+		case fcForceSingleCoil:
+			if (*(volatile uint8_t *)t->data&1) ctx->buffer[4]=0xFF;
+			else ctx->buffer[4]=0x00;
+			ctx->buffer[5]=0x00;
+			break;
+
+		case fcPresetSingleRegister:
+			intToModbusRegister((volatile uint16_t *)t->data,ctx->buffer+4,1);
+			break;
+
+		case fcForceMultipleCoils:
+			if (!t->amount || (t->amount>1968) || (t->amount>((MaxFrameIndex-8)*8))) return 0;
+			bytes=(t->amount+7)/8;
+			ctx->buffer[6]=bytes;
+			ctx->buffer[6+bytes]=0x00; //fill last data byte with zeros
+			listBitRangeCopy((volatile uint8_t *)t->data,0,ctx->buffer+7,0,t->amount);
+			packtop=6+bytes;
+			break;
+
+		case fcPresetMultipleRegisters:
+			if (!t->amount || (t->amount>123) || (t->amount>((MaxFrameIndex-8)/2))) return 0;
+			ctx->buffer[6]=(uint8_t)(t->amount*2);
+			#ifdef ZERO_COPY_TRANSMIT
+			modbusCtxSendRegisters(ctx,6,(volatile uint16_t *)t->data,t->amount);
+			return 1;
+			#else
+			intToModbusRegister((volatile uint16_t *)t->data,ctx->buffer+7,t->amount);
+			packtop=6+ctx->buffer[6];
+			#endif
+			break;
+
+		default:
+			return 0;
+	}
+	modbusCtxSendMessage(ctx,packtop);
+	return 1;
 }
 
-/* @brief: copies a single or multiple 16-bit-words from one array of integers to an array of bytes
+/* @brief: Finishes the current transaction.
 *
 */
-void modbusRegisterToInt(volatile uint8_t *inreg, volatile uint16_t *outreg, uint8_t amount)
+static void modbusMasterFinish(modbusContext *ctx, uint8_t status)
 {
-	for (uint8_t c=0; c<amount; c++)
+	modbusTransaction *t=ctx->masterCurrent;
+	ctx->masterCurrent=0;
+	ctx->masterState=masterIdle;
+	t->status=status;
+	if (t->callback) t->callback(t);
+}
+
+#if MASTER_SLAVE_SLOTS > 0
+/* @brief: Returns the statistics of a slave, 0 for broadcasts or if all slots are taken.
+*
+*/
+static masterSlaveStats *modbusMasterStats(modbusContext *ctx, uint8_t slave)
+{
+	masterSlaveStats *unused=0;
+	if (!slave) return 0;
+	for (uint8_t c=0; c<MASTER_SLAVE_SLOTS; c++)
 	{
-		*(outreg+c) = (*(inreg+c*2) << 8) + *(inreg+1+c*2);
+		if (ctx->masterSlaves[c].slave==slave) return &ctx->masterSlaves[c];
+		if (!unused && !ctx->masterSlaves[c].slave) unused=&ctx->masterSlaves[c];
+	}
+	if (unused) unused->slave=slave;
+	return unused;
+}
+
+uint8_t modbusCtxMasterSlaveOffline(modbusContext *ctx, uint8_t slave)
+{
+	uint8_t offline=0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		for (uint8_t c=0; c<MASTER_SLAVE_SLOTS; c++)
+		{
+			if (ctx->masterSlaves[c].slave==slave) offline=(ctx->masterSlaves[c].backoff!=0);
+		}
 	}
+	return offline;
 }
 
-/* @brief: Handles single/multiple register reading and single/multiple register writing.
+/* @brief: Returns the response timeout for the current transaction.
 *
-*         Arguments: - ptrToInArray: pointer to the user's data array containing registers
-*                    - startAddress: address of the first register in the supplied array
-*                    - size: input array size in the requested format (16bit-registers)
+*/
+static uint16_t modbusMasterTimeout(modbusContext *ctx)
+{
+	uint32_t timeout;
+	if (!ctx->masterStats || !ctx->masterStats->srtt) return MASTER_RESPONSE_TIMEOUT;
+	timeout=(ctx->masterStats->srtt>>3)+ctx->masterStats->rttvar+MASTER_TIMEOUT_MARGIN;
+	if (timeout>MASTER_RESPONSE_TIMEOUT) return MASTER_RESPONSE_TIMEOUT;
+	return (uint16_t)timeout;
+}
+
+/* @brief: The current slave has responded after rtt ticks.
 *
 */
-uint8_t modbusExchangeRegisters(volatile uint16_t *ptrToInArray, uint16_t startAddress, uint16_t size)
+static void modbusMasterAlive(modbusContext *ctx, uint16_t rtt)
+{
+	if (!ctx->masterStats) return;
+	if (!rtt) rtt=1;
+	if (!ctx->masterStats->srtt) { //first measurement
+		ctx->masterStats->srtt=(uint32_t)rtt<<3;
+		ctx->masterStats->rttvar=(uint32_t)rtt<<1;
+	} else {
+		int32_t delta=(int32_t)rtt-(int32_t)(ctx->masterStats->srtt>>3);
+		ctx->masterStats->srtt+=delta; //srtt=7/8*srtt+1/8*rtt
+		if (delta<0) delta=-delta;
+		ctx->masterStats->rttvar+=delta-(ctx->masterStats->rttvar>>2); //rttvar=3/4*rttvar+1/4*|delta|
+	}
+	ctx->masterStats->failures=0;
+	ctx->masterStats->backoff=0;
+}
+
+/* @brief: The current slave has not responded in time.
+*
+*/
+static void modbusMasterFailed(modbusContext *ctx)
+{
+	if (!ctx->masterStats) return;
+	if (ctx->masterStats->rttvar<MASTER_RESPONSE_TIMEOUT) ctx->masterStats->rttvar<<=1; //be more patient next time
+	if (ctx->masterStats->failures<255) ctx->masterStats->failures++;
+	if (ctx->masterStats->failures>=MASTER_OFFLINE_FAILURES)
+	{
+		if (!ctx->masterStats->backoff) ctx->masterStats->backoff=MASTER_BACKOFF_MIN;
+		else if (ctx->masterStats->backoff<MASTER_BACKOFF_MAX/2) ctx->masterStats->backoff<<=1;
+		else ctx->masterStats->backoff=MASTER_BACKOFF_MAX;
+		ctx->masterStats->retry=ctx->ticks+ctx->masterStats->backoff;
+	}
+}
+#else
+uint8_t modbusCtxMasterSlaveOffline(modbusContext *ctx, uint8_t slave)
+{
+	(void)ctx;
+	(void)slave;
+	return 0;
+}
+
+#define modbusMasterTimeout(ctx) MASTER_RESPONSE_TIMEOUT
+#define modbusMasterAlive(ctx,rtt)
+#define modbusMasterFailed(ctx)
+#endif
+
+/* @brief: Starts the next queued transaction. Call only while the bus is idle.
+*
+*/
+static void modbusMasterNext(modbusContext *ctx)
 {
-	if ((modbusDataLocation>=startAddress) && ((startAddress+size)>=(modbusDataAmount+modbusDataLocation))) {
-		
-		if ((rxbuffer[1]==fcReadHoldingRegisters) || (rxbuffer[1]==fcReadInputRegisters) )
+	while (!ctx->masterCurrent && ctx->masterQueueHead)
+	{
+		modbusTransaction *t=ctx->masterQueueHead;
+		ctx->masterQueueHead=t->next;
+		if (!ctx->masterQueueHead) ctx->masterQueueTail=0;
+		ctx->masterCurrent=t;
+		t->status=TransactionBusy;
+		#if MASTER_SLAVE_SLOTS > 0
+		ctx->masterStats=modbusMasterStats(ctx,t->slave);
+		if (ctx->masterStats && ctx->masterStats->backoff && ((int32_t)(ctx->ticks-ctx->masterStats->retry)<0))
 		{
-			if ((modbusDataAmount*2)<=(MaxFrameIndex-4)) //message buffer big enough?
-			{
-				rxbuffer[2]=(unsigned char)(modbusDataAmount*2);
-				intToModbusRegister(ptrToInArray+(modbusDataLocation-startAddress),rxbuffer+3,modbusDataAmount);
-				modbusSendMessage(2+rxbuffer[2]);
-				return 1;
-			} else modbusSendException(ecIllegalDataValue);
+			modbusMasterFinish(ctx,TransactionOffline); //do not waste bus time
+			continue;
+		}
+		#endif
+		if (modbusMasterSend(ctx,t)) ctx->masterState=masterSending;
+		else modbusMasterFinish(ctx,TransactionInvalid);
+	}
+}
+
+/* @brief: Called by the transmit complete ISR.
+*
+*/
+static void modbusMasterTxComplete(modbusContext *ctx)
+{
+	if (ctx->masterState==masterSending)
+	{
+		if (ctx->masterCurrent->slave==0) { //broadcast, there is no response
+			ctx->masterTimeout=MASTER_BROADCAST_DELAY;
+		} else {
+			ctx->masterTimeoutStart=modbusMasterTimeout(ctx);
+			ctx->masterTimeout=ctx->masterTimeoutStart;
 		}
-		else if (rxbuffer[1]==fcPresetMultipleRegisters)
+		ctx->masterState=masterWaiting;
+	}
+}
+
+/* @brief: Counts down the response timeout. Called by modbusTickTimer.
+*
+*/
+static void modbusMasterTick(modbusContext *ctx)
+{
+	if ((ctx->masterState==masterWaiting) && !(ctx->busState&(1<<Receiving)))
+	{
+		if (!--ctx->masterTimeout)
 		{
-			if (((rxbuffer[6])>=modbusDataAmount*2) && ((DataPos-9)>=rxbuffer[6])) //enough data received?
-			{
-				modbusRegisterToInt(rxbuffer+7,ptrToInArray+(modbusDataLocation-startAddress),(unsigned char)(modbusDataAmount));
-				modbusSendMessage(5);
-				return 1;
-			} else modbusSendException(ecIllegalDataValue);//too few data bytes received
+			if (ctx->masterCurrent->slave==0) modbusMasterFinish(ctx,TransactionOk); //the broadcast has been seen by everyone
+			else {
+				modbusMasterFailed(ctx);
+				modbusMasterFinish(ctx,TransactionTimeout);
+			}
+			if (modbusBusIdle(ctx)) modbusMasterNext(ctx);
 		}
-		else if (rxbuffer[1]==fcPresetSingleRegister)
+	}
+}
+
+/* @brief: Handles a response of the slave addressed by the current transaction.
+*          The crc has already been checked.
+*
+*/
+static void modbusMasterResponse(modbusContext *ctx)
+{
+	modbusTransaction *t=ctx->masterCurrent;
+	uint8_t status=TransactionOk;
+	ctx->busState=(1<<TimerActive)|(1<<BusTimedOut); //the end of the frame was detected after more than 3.5 characters of silence, the timer keeps counting it
+	modbusMasterAlive(ctx,ctx->masterTimeoutStart-ctx->masterTimeout); //the timeout stops counting with the first byte received
+	if (ctx->buffer[1]==(t->function|0x80))
+	{
+		t->exceptionCode=ctx->buffer[2];
+		status=TransactionException;
+	}
+	else if (ctx->buffer[1]!=t->function) status=TransactionInvalid;
+	#ifdef MODBUS_GATEWAY
+	else if (t->raw)
+	{
+		if (ctx->dataPos>=4) {
+			t->amount=ctx->dataPos-4; //address, function code and crc
+			for (uint8_t c=0; c<t->amount; c++) ((volatile uint8_t *)t->data)[c]=ctx->buffer[2+c];
+		} else status=TransactionInvalid;
+	}
+	#endif
+	else if ((t->function==fcReadCoilStatus) || (t->function==fcReadInputStatus))
+	{
+		if ((ctx->buffer[2]==(t->amount+7)/8) && ((ctx->dataPos-5)>=ctx->buffer[2])) //enough data received?
 		{
-			modbusRegisterToInt(rxbuffer+4,ptrToInArray+(modbusDataLocation-startAddress),1);
-			modbusSendMessage(5);
-			return 1;
-		} 
-		//modbusSendException(ecSlaveDeviceFailure); //inapropriate call of modbusExchangeRegisters
-		return 0;
-		} else {
-		modbusSendException(ecIllegalDataValue);
-		return 0;
+			if (t->data) listBitRangeCopy(ctx->buffer+3,0,(volatile uint8_t *)t->data,0,t->amount);
+		} else status=TransactionInvalid;
 	}
+	else if ((t->function==fcReadHoldingRegisters) || (t->function==fcReadInputRegisters))
+	{
+		if ((ctx->buffer[2]==t->amount*2) && ((ctx->dataPos-5)>=ctx->buffer[2])) //enough data received?
+		{
+			if (t->data) modbusRegisterToInt(ctx->buffer+3,(volatile uint16_t *)t->data,(uint8_t)t->amount);
+		} else status=TransactionInvalid;
+	}
+	else //writes echo the address and the value or quantity of the request
+	{
+		uint16_t echo=t->amount;
+		if (t->function==fcForceSingleCoil) echo=(*(volatile uint8_t *)t->data&1) ? 0xFF00 : 0x0000;
+		else if (t->function==fcPresetSingleRegister) echo=*(volatile uint16_t *)t->data;
+		if ((ctx->dataPos<8) || ((((uint16_t)ctx->buffer[2]<<8)|ctx->buffer[3])!=t->address) || ((((uint16_t)ctx->buffer[4]<<8)|ctx->buffer[5])!=echo)) status=TransactionInvalid;
+	}
+	modbusMasterFinish(ctx,status);
+	modbusMasterNext(ctx);
 }
 
-/* @brief: Handles single/multiple input/coil reading and single/multiple coil writing.
+uint8_t modbusCtxMasterSubmit(modbusContext *ctx, modbusTransaction *t)
+{
+	uint8_t submitted=0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		if ((t->status!=TransactionQueued) && (t->status!=TransactionBusy))
+		{
+			t->next=0;
+			t->status=TransactionQueued;
+			if (ctx->masterQueueTail) ctx->masterQueueTail->next=t;
+			else ctx->masterQueueHead=t;
+			ctx->masterQueueTail=t;
+			if (!ctx->masterCurrent && modbusBusIdle(ctx)) modbusMasterNext(ctx);
+			submitted=1;
+		}
+	}
+	return submitted;
+}
+
+uint32_t modbusCtxGetTicks(modbusContext *ctx)
+{
+	uint32_t ticks;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+	{
+		ticks=ctx->ticks;
+	}
+	return ticks;
+}
+#endif
+
+#ifdef MODBUS_POLL
+/* @brief: returns 1 if entry e is part of the range of the current poll request. hi is the
+*          address after the range, 0x10000 at the end of the address space.
 *
-*         Arguments: - ptrToInArray: pointer to the user's data array containing bits
-*                    - startAddress: address of the first bit in the supplied array
-*                    - size: input array size in the requested format (bits)
+*/
+static inline uint8_t modbusPollCovers(modbusContext *ctx, modbusPollEntry *e, uint16_t lo, uint32_t hi)
+{
+	return (e->slave==ctx->pollTransaction.slave) && (e->function==ctx->pollTransaction.function) && (e->address>=lo) && ((uint32_t)e->address+e->amount<=hi);
+}
+
+/* @brief: Spreads the response of a merged read over all entries it covers. Called from
+*          ISR context while the response is still in rxbuffer.
 *
 */
-uint8_t modbusExchangeBits(volatile uint8_t *ptrToInArray, uint16_t startAddress, uint16_t size)
+static void modbusPollDone(modbusTransaction *t)
 {
-	if ((modbusDataLocation>=startAddress) && ((startAddress+size)>=(modbusDataAmount+modbusDataLocation)))
+	modbusContext *ctx=(modbusContext *)((char *)t-offsetof(modbusContext,pollTransaction)); //t is the instance's pollTransaction
+	uint16_t lo=t->address;
+	uint32_t hi=(uint32_t)t->address+t->amount;
+	for (uint8_t c=0; c<ctx->pollCount; c++)
 	{
-		if ((rxbuffer[1]==fcReadInputStatus) || (rxbuffer[1]==fcReadCoilStatus))
+		modbusPollEntry *e=&ctx->pollEntries[c];
+		if (!modbusPollCovers(ctx,e,lo,hi)) continue;
+		if (t->status==TransactionOk)
 		{
-			if (modbusDataAmount<=((MaxFrameIndex-4)*8)) //message buffer big enough?
-			{
-				rxbuffer[2]=(modbusDataAmount/8);
-				if (modbusDataAmount%8>0)
-				{
-					rxbuffer[(uint8_t)(modbusDataAmount/8)+3]=0x00; //fill last data byte with zeros
-					rxbuffer[2]++;
-				}
-				for (uint16_t c = 0; c<modbusDataAmount; c++)
-				{
-					listBitCopy(ptrToInArray,modbusDataLocation-startAddress+c,rxbuffer+3,c);
-				}
-				modbusSendMessage(rxbuffer[2]+2);
-				return 1;
-			} else modbusSendException(ecIllegalDataValue); //too many bits requested within single request
+			if ((t->function==fcReadCoilStatus) || (t->function==fcReadInputStatus))
+				listBitRangeCopy(ctx->buffer+3,e->address-lo,(volatile uint8_t *)e->data,0,e->amount);
+			else modbusRegisterToInt(ctx->buffer+3+(e->address-lo)*2,(volatile uint16_t *)e->data,(uint8_t)e->amount);
 		}
-		else if (rxbuffer[1]==fcForceMultipleCoils)
+		e->status=t->status;
+	}
+}
+
+void modbusCtxPollInit(modbusContext *ctx, modbusPollEntry *entries, uint8_t count)
+{
+	uint32_t now=modbusCtxGetTicks(ctx);
+	ctx->pollEntries=entries;
+	ctx->pollCount=count;
+	for (uint8_t c=0; c<count; c++)
+	{
+		entries[c].due=now;
+		entries[c].status=TransactionOk;
+	}
+	ctx->pollTransaction.callback=modbusPollDone;
+	ctx->pollTransaction.data=0;
+}
+
+void modbusCtxPollTask(modbusContext *ctx)
+{
+	modbusPollEntry *first=0;
+	uint32_t now;
+	uint16_t lo, maxSpan, gap;
+	uint32_t hi;
+	uint8_t grown;
+	if ((ctx->pollTransaction.status==TransactionQueued) || (ctx->pollTransaction.status==TransactionBusy)) return;
+	now=modbusCtxGetTicks(ctx);
+	for (uint8_t c=0; c<ctx->pollCount; c++) //find the most overdue entry
+	{
+		modbusPollEntry *e=&ctx->pollEntries[c];
+		if (((int32_t)(now-e->due)>=0) && (!first || ((int32_t)(e->due-first->due)<0))) first=e;
+	}
+	if (!first) return;
+
+	if ((first->function==fcReadCoilStatus) || (first->function==fcReadInputStatus))
+	{
+		maxSpan=(MaxFrameIndex-4)*8;
+		if (maxSpan>2000) maxSpan=2000;
+		gap=POLL_MAX_GAP*8;
+	} else {
+		maxSpan=(MaxFrameIndex-4)/2;
+		if (maxSpan>125) maxSpan=125;
+		gap=POLL_MAX_GAP/2;
+	}
+	ctx->pollTransaction.slave=first->slave;
+	ctx->pollTransaction.function=first->function;
+	lo=first->address;
+	hi=(uint32_t)first->address+first->amount;
+	do { //merge neighbours until the range stops growing
+		grown=0;
+		for (uint8_t c=0; c<ctx->pollCount; c++)
 		{
-			if (((rxbuffer[6]*8)>=modbusDataAmount) && ((DataPos-9)>=rxbuffer[6])) //enough data received?
-			{
-				for (uint16_t c = 0; c<modbusDataAmount; c++)
-				{
-					listBitCopy(rxbuffer+7,c,ptrToInArray,modbusDataLocation-startAddress+c);
-				}
-				modbusSendMessage(5);
-				return 1;
-			} else modbusSendException(ecIllegalDataValue);//exception too few data bytes received
-		}
-		else if (rxbuffer[1]==fcForceSingleCoil) {
-			listBitCopy(rxbuffer+4,0,ptrToInArray,modbusDataLocation-startAddress);
-			modbusSendMessage(5); 
-			return 1;
+			modbusPollEntry *e=&ctx->pollEntries[c];
+			uint16_t newLo=lo;
+			uint32_t newHi=hi;
+			if ((e->slave!=first->slave) || (e->function!=first->function) || modbusPollCovers(ctx,e,lo,hi)) continue;
+			if ((e->address>hi+gap) || ((uint32_t)e->address+e->amount+gap<lo)) continue; //too far away
+			if (e->address<newLo) newLo=e->address;
+			if ((uint32_t)e->address+e->amount>newHi) newHi=(uint32_t)e->address+e->amount;
+			if (newHi-newLo>maxSpan) continue;
+			lo=newLo;
+			hi=newHi;
+			grown=1;
 		}
-		//modbusSendException(ecSlaveDeviceFailure); //inanpropriate call of modbusExchangeBits
-		return 0;
-	} else
+	} while (grown);
+
+	for (uint8_t c=0; c<ctx->pollCount; c++)
 	{
-		modbusSendException(ecIllegalDataValue);
-		return 0;
+		modbusPollEntry *e=&ctx->pollEntries[c];
+		if (modbusPollCovers(ctx,e,lo,hi)) e->due=now+e->period;
 	}
+	ctx->pollTransaction.address=lo;
+	ctx->pollTransaction.amount=(uint16_t)(hi-lo);
+	modbusCtxMasterSubmit(ctx,&ctx->pollTransaction);
+}
+#endif
+
+/*
+* The single instance API, all of it works on modbusPrimary.
+*/
+void modbusInit(void)
+{
+	modbusCtxInit(&modbusPrimary);
+}
+
+#if TIMING_MODE == TIMING_TICK
+void modbusTickTimer(void)
+{
+	modbusCtxTickTimer(&modbusPrimary);
+}
+#endif
+
+uint8_t modbusGetBusState(void)
+{
+	return modbusCtxGetBusState(&modbusPrimary);
+}
+
+void modbusReset(void)
+{
+	modbusCtxReset(&modbusPrimary);
+}
+
+void modbusSendMessage(unsigned char packtop)
+{
+	modbusCtxSendMessage(&modbusPrimary,packtop);
+}
+
+void modbusSendException(unsigned char exceptionCode)
+{
+	modbusCtxSendException(&modbusPrimary,exceptionCode);
+}
+
+uint16_t modbusRequestedAmount(void)
+{
+	return modbusCtxRequestedAmount(&modbusPrimary);
+}
+
+uint16_t modbusRequestedAddress(void)
+{
+	return modbusCtxRequestedAddress(&modbusPrimary);
+}
+
+uint16_t modbusRequestedWriteAmount(void)
+{
+	return modbusCtxRequestedWriteAmount(&modbusPrimary);
+}
+
+uint16_t modbusRequestedWriteAddress(void)
+{
+	return modbusCtxRequestedWriteAddress(&modbusPrimary);
+}
+
+uint8_t modbusIsInRange(uint16_t adr)
+{
+	return modbusCtxIsInRange(&modbusPrimary,adr);
+}
+
+uint8_t modbusIsRangeInRange(uint16_t startAdr, uint16_t lastAdr)
+{
+	return modbusCtxIsRangeInRange(&modbusPrimary,startAdr,lastAdr);
+}
+
+uint8_t modbusExchangeBits(volatile uint8_t *ptrToInArray, uint16_t startAddress, uint16_t size)
+{
+	return modbusCtxExchangeBits(&modbusPrimary,ptrToInArray,startAddress,size);
+}
+
+uint8_t modbusExchangeRegisters(volatile uint16_t *ptrToInArray, uint16_t startAddress, uint16_t size)
+{
+	return modbusCtxExchangeRegisters(&modbusPrimary,ptrToInArray,startAddress,size);
+}
+
+uint8_t modbusExchangeFileRecords(modbusFileHandler handler)
+{
+	return modbusCtxExchangeFileRecords(&modbusPrimary,handler);
+}
+
+#ifdef MODBUS_DIAGNOSTICS
+void modbusGetCounters(modbusCounters *counters)
+{
+	modbusCtxGetCounters(&modbusPrimary,counters);
+}
+
+void modbusClearCounters(void)
+{
+	modbusCtxClearCounters(&modbusPrimary);
+}
+
+uint8_t modbusDiagnostics(void)
+{
+	return modbusCtxDiagnostics(&modbusPrimary);
+}
+#endif
+
+#if ADDRESS_MODE == SINGLE_ADR
+uint8_t modbusGetAddress(void)
+{
+	return modbusCtxGetAddress(&modbusPrimary);
+}
+
+void modbusSetAddress(unsigned char newadr)
+{
+	modbusCtxSetAddress(&modbusPrimary,newadr);
+}
+#elif defined(ADDRESS_FILTER)
+void modbusSetAddressFilter(uint8_t adr, uint8_t accept)
+{
+	modbusCtxSetAddressFilter(&modbusPrimary,adr,accept);
+}
+
+uint8_t modbusAddressAccepted(uint8_t adr)
+{
+	return modbusCtxAddressAccepted(&modbusPrimary,adr);
+}
+#endif
+
+#ifdef ZERO_COPY_TRANSMIT
+void modbusSendRegisters(unsigned char packtop, volatile uint16_t *ptrToRegisters, uint8_t amount)
+{
+	modbusCtxSendRegisters(&modbusPrimary,packtop,ptrToRegisters,amount);
+}
+#endif
+
+#ifdef MODBUS_MASTER
+uint8_t modbusMasterSubmit(modbusTransaction *t)
+{
+	return modbusCtxMasterSubmit(&modbusPrimary,t);
+}
+
+uint8_t modbusMasterSlaveOffline(uint8_t slave)
+{
+	return modbusCtxMasterSlaveOffline(&modbusPrimary,slave);
+}
+
+uint32_t modbusGetTicks(void)
+{
+	return modbusCtxGetTicks(&modbusPrimary);
+}
+#endif
+
+#ifdef MODBUS_POLL
+void modbusPollInit(modbusPollEntry *entries, uint8_t count)
+{
+	modbusCtxPollInit(&modbusPrimary,entries,count);
+}
+
+void modbusPollTask(void)
+{
+	modbusCtxPollTask(&modbusPrimary);
+}
+#endif
+
+#ifdef MODBUS_EVENTS
+void modbusSetEventHandler(modbusEventHandler handler)
+{
+	modbusCtxSetEventHandler(&modbusPrimary,handler);
+}
+
+uint8_t modbusGetEvents(void)
+{
+	return modbusCtxGetEvents(&modbusPrimary);
+}
+
+uint8_t modbusWaitForEvent(void)
+{
+	return modbusCtxWaitForEvent(&modbusPrimary);
 }
+
+void modbusWakeUp(void)
+{
+	modbusCtxWakeUp(&modbusPrimary);
+}
+#endif
@@ -40,7 +40,28 @@ THE POSSIBILITY OF SUCH DAMAGE.
 #ifdef __cplusplus
 extern "C" {
 #endif
+/*
+ * Available hardware backends.
+*/
+#define HAL_AVR 1
+#define HAL_LINUX 2
+#define HAL_SIM 3
+
+/*
+* Use HAL_AVR, HAL_LINUX or HAL_SIM, default: HAL_AVR
+* HAL_LINUX runs the very same core on a serial device or pseudo terminal under Linux, e.g.
+* for gateways or for profiling it with the usual host tools. See yaMBSlinux.h.
+* HAL_SIM runs instances on a simulated bus in virtual time, for timing tests. See yaMBSsim.h.
+*/
+#ifndef MODBUS_HAL
+#define MODBUS_HAL HAL_AVR
+#endif
+
+#if MODBUS_HAL == HAL_AVR
 #include <avr/io.h>
+#else
+#include <stdint.h>
+#endif
 /** 
  *  @code #include <yaMBSIavr.h> @endcode
  * 
@@ -58,6 +79,17 @@ extern "C" {
 #define BAUD_SPD 19200L
 #endif
 
+/*
+* Largest error of the baud rate generated from F_CPU in 1/1000 that still compiles, default: 20.
+* The datasheets recommend 2% at most for 8N1, for both ends of the line together. The
+* prescaler is rounded to the nearest value and double speed (U2X, CLK2X on the ATtiny3226) is
+* only used if it gives a smaller error, the receiver samples each bit less often with it.
+* UART_DOUBLE_SPEED 0 or 1 overrides the choice.
+*/
+#ifndef BAUD_TOLERANCE
+#define BAUD_TOLERANCE 20
+#endif
+
 /*
 * Definitions for transceiver enable pin.
 */
@@ -75,11 +107,14 @@ extern "C" {
 
 /**
  * @brief    
- *           At the moment the user has to set the value for Baudrate and
- *           speed mode manually. The values depend on the operating frequency 
- *           of your AVR and can be found in its datasheet.
+ *           The baud rate register and the speed mode are derived from F_CPU and
+ *           BAUD_SPD, see BAUD_TOLERANCE.
+ *           The SECOND_UART definitions describe the second USART of devices
+ *           that have one, see MODBUS_SECOND_UART.
  */
-#if defined(__AVR_ATtiny2313__)
+#if MODBUS_HAL != HAL_AVR
+/* no registers to care about */
+#elif defined(__AVR_ATtiny2313__)
 #define UART_TRANSMIT_COMPLETE_INTERRUPT USART_TX_vect
 #define UART_RECEIVE_INTERRUPT   USART_RX_vect
 #define UART_TRANSMIT_INTERRUPT  USART_UDRE_vect
@@ -87,6 +122,8 @@ extern "C" {
 #define UART_CONTROL  UCSRB
 #define UART_DATA     UDR
 #define UART_UDRIE    UDRIE
+#define UART_FE       FE
+#define UART_DOR      DOR
 
 #elif defined(__AVR_ATmega164P__)
 #define UART_TRANSMIT_COMPLETE_INTERRUPT USART1_TX_vect
@@ -96,6 +133,8 @@ extern "C" {
 #define UART_CONTROL  UCSR1B
 #define UART_DATA     UDR1
 #define UART_UDRIE    UDRIE1
+#define UART_FE       FE1
+#define UART_DOR      DOR1
 #define UCSRC UCSR1C
 #define RXCIE RXCIE1
 #define TXCIE TXCIE1
@@ -105,6 +144,17 @@ extern "C" {
 #define U2X U2X1
 #define UBRRH UBRR1H
 #define UBRRL UBRR1L
+#define SECOND_UART_TRANSMIT_COMPLETE_INTERRUPT USART0_TX_vect
+#define SECOND_UART_RECEIVE_INTERRUPT   USART0_RX_vect
+#define SECOND_UART_TRANSMIT_INTERRUPT  USART0_UDRE_vect
+#define SECOND_UART_STATUS   UCSR0A
+#define SECOND_UART_CONTROL  UCSR0B
+#define SECOND_UART_DATA     UDR0
+#define SECOND_UART_FE       FE0
+#define SECOND_UART_DOR      DOR0
+#define SECOND_UCSRC UCSR0C
+#define SECOND_UBRRH UBRR0H
+#define SECOND_UBRRL UBRR0L
 
 #elif defined(__AVR_ATmega168PA__)|(__AVR_ATmega88PA__)|(__AVR_ATmega328P__)|(__AVR_ATmega168P__)|(__AVR_ATmega88P__)
 #define UART_TRANSMIT_COMPLETE_INTERRUPT USART_TX_vect
@@ -114,6 +164,8 @@ extern "C" {
 #define UART_CONTROL  UCSR0B
 #define UART_DATA     UDR0
 #define UART_UDRIE    UDRIE0
+#define UART_FE       FE0
+#define UART_DOR      DOR0
 #define UCSRC UCSR0C
 #define RXCIE RXCIE0
 #define TXCIE TXCIE0
@@ -132,6 +184,8 @@ extern "C" {
 #define UART_CONTROL  UCSR0B
 #define UART_DATA     UDR0
 #define UART_UDRIE    UDRIE0
+#define UART_FE       FE0
+#define UART_DOR      DOR0
 #define UCSRC UCSR0C
 #define RXCIE RXCIE0
 #define TXCIE TXCIE0
@@ -141,6 +195,17 @@ extern "C" {
 #define U2X U2X0
 #define UBRRH UBRR0H
 #define UBRRL UBRR0L
+#define SECOND_UART_TRANSMIT_COMPLETE_INTERRUPT USART1_TX_vect
+#define SECOND_UART_RECEIVE_INTERRUPT   USART1_RX_vect
+#define SECOND_UART_TRANSMIT_INTERRUPT  USART1_UDRE_vect
+#define SECOND_UART_STATUS   UCSR1A
+#define SECOND_UART_CONTROL  UCSR1B
+#define SECOND_UART_DATA     UDR1
+#define SECOND_UART_FE       FE1
+#define SECOND_UART_DOR      DOR1
+#define SECOND_UCSRC UCSR1C
+#define SECOND_UBRRH UBRR1H
+#define SECOND_UBRRL UBRR1L
 
 #elif defined(__AVR_ATtiny441__)
 #define UART_TRANSMIT_COMPLETE_INTERRUPT USART0_TX_vect
@@ -150,6 +215,8 @@ extern "C" {
 #define UART_CONTROL  UCSR0B
 #define UART_DATA     UDR0
 #define UART_UDRIE    UDRIE0
+#define UART_FE       FE0
+#define UART_DOR      DOR0
 #define UCSRC UCSR0C
 #define RXCIE RXCIE0
 #define TXCIE TXCIE0
@@ -168,6 +235,8 @@ extern "C" {
 #define UART_CONTROL  UCSRB
 #define UART_DATA     UDR
 #define UART_UDRIE    UDRIE
+#define UART_FE       FE
+#define UART_DOR      DOR
 
 #elif defined(__AVR_AT90PWM3B__)
 #define UART_TRANSMIT_COMPLETE_INTERRUPT USART_TX_vect
@@ -177,6 +246,8 @@ extern "C" {
 #define UART_CONTROL  UCSRB
 #define UART_DATA     UDR
 #define UART_UDRIE    UDRIE
+#define UART_FE       FE
+#define UART_DOR      DOR
 
 #elif defined(__AVR_ATmega1284P__)
 #define UART_TRANSMIT_COMPLETE_INTERRUPT USART0_TX_vect
@@ -186,6 +257,8 @@ extern "C" {
 #define UART_CONTROL  UCSR0B
 #define UART_DATA     UDR0
 #define UART_UDRIE    UDRIE0
+#define UART_FE       FE0
+#define UART_DOR      DOR0
 #define UCSRC UCSR0C
 #define RXCIE RXCIE0
 #define TXCIE TXCIE0
@@ -195,6 +268,17 @@ extern "C" {
 #define U2X U2X0
 #define UBRRH UBRR0H
 #define UBRRL UBRR0L
+#define SECOND_UART_TRANSMIT_COMPLETE_INTERRUPT USART1_TX_vect
+#define SECOND_UART_RECEIVE_INTERRUPT   USART1_RX_vect
+#define SECOND_UART_TRANSMIT_INTERRUPT  USART1_UDRE_vect
+#define SECOND_UART_STATUS   UCSR1A
+#define SECOND_UART_CONTROL  UCSR1B
+#define SECOND_UART_DATA     UDR1
+#define SECOND_UART_FE       FE1
+#define SECOND_UART_DOR      DOR1
+#define SECOND_UCSRC UCSR1C
+#define SECOND_UBRRH UBRR1H
+#define SECOND_UBRRL UBRR1L
 
 #elif defined(__AVR_ATtiny3226__)
 #define attiny3226_init
@@ -213,13 +297,48 @@ extern "C" {
 #error "no definition available"
 #endif
 
-#ifndef F_CPU
+#if MODBUS_HAL != HAL_AVR
+/* the backend sets up the baud rate */
+#elif !defined(F_CPU)
 #error " F_CPU not defined "
 #else
+/*
+* The baud rate register for a divisor of 16 (normal speed) or 8 (double speed), rounded, and
+* the error of the resulting baud rate in 1/1000 (1000 if it is out of range). Usable in #if.
+*/
+#define modbusBaudLong (BAUD_SPD+0L) //int has 16 bits on avr
 #if defined(attiny3226_init)
-   #define BAUD_PRESC ((uint16_t)((8*F_CPU)/(BAUD_SPD))) /*Double speed*/
+   #define modbusBaudRegister(div) ((64*F_CPU/(div)+modbusBaudLong/2)/modbusBaudLong)
+   #define modbusBaudDivisor(div) ((div)*modbusBaudLong*modbusBaudRegister(div)) //64*F_CPU at no error
+   #define modbusBaudClock (64*F_CPU)
+   #define modbusBaudInRange(div) ((modbusBaudRegister(div)>=64) && (modbusBaudRegister(div)<=65535))
+#else
+   #define modbusBaudRegister(div) ((F_CPU+(div)*modbusBaudLong/2)/((div)*modbusBaudLong)-1)
+   #define modbusBaudDivisor(div) ((div)*modbusBaudLong*(modbusBaudRegister(div)+1)) //F_CPU at no error
+   #define modbusBaudClock (F_CPU)
+   #define modbusBaudInRange(div) ((F_CPU>=(div)*modbusBaudLong/2) && (modbusBaudRegister(div)<=4095))
+#endif
+#define modbusBaudError(div) (!modbusBaudInRange(div) ? 1000 : \
+	(modbusBaudClock>modbusBaudDivisor(div) ? modbusBaudClock-modbusBaudDivisor(div) : modbusBaudDivisor(div)-modbusBaudClock)*1000/modbusBaudDivisor(div))
+#ifndef UART_DOUBLE_SPEED
+#if modbusBaudError(16)<=modbusBaudError(8)
+#define UART_DOUBLE_SPEED 0
 #else
-   #define _UBRR (F_CPU / 8 / BAUD_SPD ) -1
+#define UART_DOUBLE_SPEED 1
+#endif
+#endif
+#if UART_DOUBLE_SPEED
+#define modbusBaudSpeedDivisor 8
+#else
+#define modbusBaudSpeedDivisor 16
+#endif
+#if modbusBaudError(modbusBaudSpeedDivisor)>BAUD_TOLERANCE
+#error "BAUD_SPD cannot be generated from F_CPU within BAUD_TOLERANCE, see modbusBaudError"
+#endif
+#if defined(attiny3226_init)
+   #define BAUD_PRESC ((uint16_t)modbusBaudRegister(modbusBaudSpeedDivisor))
+#else
+   #define _UBRR ((uint16_t)modbusBaudRegister(modbusBaudSpeedDivisor))
 #endif
 #endif /* F_CPU */
 /*
@@ -231,8 +350,19 @@ extern "C" {
 /*
 * Use SINGLE_ADR or MULTIPLE_ADR, default: SINGLE_ADR
 * This is useful for building gateways, routers or clients that for whatever reason need multiple addresses.
+* A slave looks at the first byte of a frame in the receive ISR already: frames for other addresses
+* are not stored, the slave just waits for the silence after them.
 */
+#ifndef ADDRESS_MODE
 #define ADDRESS_MODE SINGLE_ADR
+#endif
+
+/*
+* Define ADDRESS_FILTER in MULTIPLE_ADR mode to accept only the addresses (units) set with
+* modbusSetAddressFilter, kept in a bitmap of 256 bits per instance. Without it every frame on the
+* bus is checked and handed to the application. All addresses are rejected after start-up.
+*/
+//#define ADDRESS_FILTER
 
 /*
 * Use 485 or 232, default: 485
@@ -241,26 +371,302 @@ extern "C" {
 #define attiny3226_485 485
 #define PHYSICAL_TYPE attiny3226_485 //possible values: 485, 232 
 
+/*
+ * Available CRC implementations.
+*/
+#define CRC_BITWISE 1
+#define CRC_NIBBLE 2
+#define CRC_TABLE 3
 
-#if BAUD_SPD>=19200
-#define modbusInterFrameDelayReceiveStart 16
-#define modbusInterFrameDelayReceiveEnd 18
-#define modbusInterCharTimeout 7
-#else
-#define modbusBlocksize 10
-#define modbusBlockTime ((float)modbusBlocksize*1000000)/((float) BAUD_SPD) //is 260 for 38400
-#define timerISROccurenceTime 100 //time in microseconds between two calls of modbusTickTimer
-#define modbusInterFrameDelayReceiveStart  (uint16_t)(modbusBlockTime*3.5/(float)timerISROccurenceTime)
-#define modbusInterFrameDelayReceiveEnd (uint16_t)(modbusBlockTime*4/(float)timerISROccurenceTime)
-#define modbusInterCharTimeout  (uint16_t)(modbusBlockTime*1.5/(float)timerISROccurenceTime)
+/*
+* Use CRC_BITWISE, CRC_NIBBLE or CRC_TABLE, default: CRC_BITWISE
+* CRC_TABLE uses a 256 entry lookup table (512 bytes of flash), one lookup per byte.
+* CRC_NIBBLE uses a 16 entry lookup table (32 bytes of flash), two lookups per byte.
+* CRC_BITWISE needs no table at all and loops over the 8 bits of every byte.
+* Measure the cycles per byte on the target with example/crc-benchmark.c before changing it.
+*/
+#ifndef CRC_MODE
+#define CRC_MODE CRC_BITWISE
 #endif
 
-/**
- * @brief    Defines the maximum Modbus frame size accepted by the device. 255 is the default
- *           and also the maximum value. However, it might be useful to set this to lower
- *           values, with 8 being the lowest possible value, in order to save on ram space.
- */
-#define MaxFrameIndex 255
+/*
+* Define CRC_ON_RECEIVE to fold every received byte into a running crc within the receive ISR.
+* The crc check at the end of a frame then takes constant time instead of stalling modbusTickTimer
+* for the length of the frame.
+*/
+//#define CRC_ON_RECEIVE
+
+/*
+ * Available end of frame detections.
+*/
+#define FRAME_END_SILENCE 1
+#define FRAME_END_PREDICT 2
+
+/*
+* Use FRAME_END_SILENCE or FRAME_END_PREDICT, default: FRAME_END_SILENCE
+* FRAME_END_SILENCE ends every frame after modbusInterFrameDelayReceiveEnd of silence, about 2ms at
+* 19200 baud, before the application gets to see it.
+* With FRAME_END_PREDICT a slave derives the length of a request from its function code and byte
+* count and hands it over as soon as the crc has arrived, for function codes 1 to 6, 8, 15 to 17
+* and 20 to 23.
+* Other function codes and frames whose crc does not match at the predicted length still end after
+* silence. The application builds the response while the bus still has to be silent, the response
+* itself is held back until modbusInterFrameDelayReceiveEnd has passed since the last byte of the
+* request, so the master sees the T3.5 it expects. Slaves only, implies CRC_ON_RECEIVE.
+*/
+#ifndef FRAME_END_MODE
+#define FRAME_END_MODE FRAME_END_SILENCE
+#endif
+#if (FRAME_END_MODE == FRAME_END_PREDICT) && !defined(CRC_ON_RECEIVE)
+#define CRC_ON_RECEIVE
+#endif
+
+/*
+* Define ZERO_COPY_TRANSMIT to let the transmit ISR calculate the crc byte by byte and append it
+* to the frame. Register read responses are then streamed directly from the user's register array
+* instead of being copied to rxbuffer first. The registers are sampled while they are being sent.
+*/
+//#define ZERO_COPY_TRANSMIT
+
+/*
+* Define FRAME_QUEUE_DEPTH (2 or more) to receive into a queue of FRAME_QUEUE_DEPTH frame buffers
+* instead of a single rxbuffer. Up to FRAME_QUEUE_DEPTH-1 completed frames wait in the queue while
+* the next one is being received. rxbuffer then points to the oldest completed frame and the
+* response is sent from there, so the application can build a response while the next request
+* is already being received. The response is copied to a transmit buffer when it is sent, which
+* frees its queue slot right away: frames that arrive while a response waits for the silence after
+* the request (FRAME_END_PREDICT) or is being sent (PHYSICAL_TYPE 232) go on into the queue.
+* Every buffer, the transmit buffer included, takes MaxFrameIndex+1 bytes of ram.
+*/
+//#define FRAME_QUEUE_DEPTH 2
+
+/*
+* Define MODBUS_FUNCTIONS to the function codes a slave handles, e.g.
+* (MODBUS_FC(fcReadHoldingRegisters)|MODBUS_FC(fcPresetMultipleRegisters)), to leave out the code
+* of all other ones in modbusExchangeBits and modbusExchangeRegisters, which answer them with
+* ecIllegalFunction. rxbuffer is then sized for the largest frame of these function codes with
+* MODBUS_MAX_REGISTERS registers or MODBUS_MAX_BITS bits (a single file record of
+* MODBUS_MAX_REGISTERS registers for fcReadFileRecord and fcWriteFileRecord), see MaxFrameIndex. Larger read requests
+* are answered with ecIllegalDataValue, larger write requests do not fit into rxbuffer and are
+* dropped. Default: all of them, 125 registers and 2000 bits, which takes the full 256 bytes.
+* Link with -Wl,--gc-sections to drop unused functions as well. See example/size-report.sh.
+*/
+#define MODBUS_FC(fc) (1UL<<(fc))
+#define MODBUS_FUNCTIONS_ALL (MODBUS_FC(1)|MODBUS_FC(2)|MODBUS_FC(3)|MODBUS_FC(4)|MODBUS_FC(5)|MODBUS_FC(6)|MODBUS_FC(8)|MODBUS_FC(15)|MODBUS_FC(16)|MODBUS_FC(20)|MODBUS_FC(21)|MODBUS_FC(22)|MODBUS_FC(23))
+#ifndef MODBUS_FUNCTIONS
+#define MODBUS_FUNCTIONS MODBUS_FUNCTIONS_ALL
+#endif
+#ifndef MODBUS_MAX_REGISTERS
+#define MODBUS_MAX_REGISTERS 125
+#endif
+#ifndef MODBUS_MAX_BITS
+#define MODBUS_MAX_BITS 2000
+#endif
+
+/*
+* Define MODBUS_EVENTS to get notified about completed frames instead of polling modbusGetBusState.
+* The ISRs post the events below, see modbusSetEventHandler and modbusWaitForEvent. Events are bits:
+* frames that wait in the queue of FRAME_QUEUE_DEPTH are reported by a single EventFrameReceived,
+* and modbusGetBusState hands them over one at a time. After an event, handle frames as long as
+* modbusGetBusState reports ReceiveCompleted.
+*/
+//#define MODBUS_EVENTS
+
+/*
+* Define MODBUS_DIAGNOSTICS to count frames, crc errors, overflows, frames for other addresses,
+* UART framing and overrun errors and exceptions sent, see modbusCounters. The ISRs increment
+* them, a few cycles per event. The application reads them with modbusGetCounters and answers
+* fcDiagnostics with modbusDiagnostics.
+*/
+//#define MODBUS_DIAGNOSTICS
+
+/*
+* Frame timing
+*/
+#define TIMING_TICK 1
+#define TIMING_ONESHOT 2
+
+/*
+* Use TIMING_TICK or TIMING_ONESHOT, default: TIMING_TICK
+* TIMING_TICK counts the silence on the bus in steps of 100us, modbusTickTimer has to be called
+* from a timer ISR that often, whether anything happens on the bus or not.
+* With TIMING_ONESHOT the library owns Timer1 (16 bit, prescaler 8, running freely) and arms
+* an output compare for the next point in time it has to act on, after every received byte and
+* after every frame: T1.5, the end of the frame and the silence before the next one. Once the bus
+* has been silent long enough no timer interrupt is taken at all until the next byte arrives, so
+* the cpu can sleep in between, see MODBUS_EVENTS. modbusPrimary uses OCR1A, modbusSecondary
+* OCR1B. Slaves only, not for the ATtiny3226.
+*/
+#ifndef TIMING_MODE
+#define TIMING_MODE TIMING_TICK
+#endif
+
+/*
+* Time in microseconds between two calls of modbusTickTimer, default: 100. The gaps of the frame
+* timing are counted in these ticks and derived from it and BAUD_SPD at compile time, see
+* modbusInterFrameDelayReceiveEnd. With TIMING_ONESHOT it is the resolution of the output compare.
+*/
+#ifndef timerISROccurenceTime
+#define timerISROccurenceTime 100
+#endif
+
+/*
+* Define MODBUS_MASTER to use the library as a bus master. Requests are queued with modbusMasterSubmit
+* and carried out in the background by the ISRs, see modbusTransaction.
+*/
+//#define MODBUS_MASTER
+
+/*
+* Time a slave gets to respond in master mode, in calls of modbusTickTimer. Default: 1s at 100us.
+* This is also the upper limit of the adaptive timeouts below.
+*/
+#ifndef MASTER_RESPONSE_TIMEOUT
+#define MASTER_RESPONSE_TIMEOUT 10000
+#endif
+
+/*
+* Silence after a broadcast before the next request is sent, in calls of modbusTickTimer. Receivers of
+* this library detect the end of the broadcast after modbusInterFrameDelayReceiveEnd and wait for another
+* modbusInterFrameDelayReceiveStart before they accept the next frame, the default is just enough for
+* that. Slaves that need time to act on a broadcast may ask for more.
+*/
+#ifndef MASTER_BROADCAST_DELAY
+#define MASTER_BROADCAST_DELAY (modbusInterFrameDelayReceiveEnd+modbusInterFrameDelayReceiveStart+1)
+#endif
+
+/*
+* In master mode the round trip time of up to MASTER_SLAVE_SLOTS slaves is tracked. Once a slave has
+* responded, it gets its smoothed round trip time plus four times the variation plus MASTER_TIMEOUT_MARGIN
+* to respond. After MASTER_OFFLINE_FAILURES timeouts in a row it is considered offline: requests fail
+* with TransactionOffline right away, except for one attempt after MASTER_BACKOFF_MIN ticks, which
+* doubles with every further failure up to MASTER_BACKOFF_MAX. Set MASTER_SLAVE_SLOTS to 0 to
+* always use MASTER_RESPONSE_TIMEOUT.
+*/
+#ifndef MASTER_SLAVE_SLOTS
+#define MASTER_SLAVE_SLOTS 8
+#endif
+
+#ifndef MASTER_TIMEOUT_MARGIN
+#define MASTER_TIMEOUT_MARGIN 50
+#endif
+
+#ifndef MASTER_OFFLINE_FAILURES
+#define MASTER_OFFLINE_FAILURES 3
+#endif
+
+#ifndef MASTER_BACKOFF_MIN
+#define MASTER_BACKOFF_MIN 10000UL
+#endif
+
+#ifndef MASTER_BACKOFF_MAX
+#define MASTER_BACKOFF_MAX 600000UL
+#endif
+
+/*
+* Define MODBUS_POLL (requires MODBUS_MASTER) to have the library poll a table of data objects
+* periodically, see modbusPollEntry. Reads of neighbouring objects on the same slave are merged
+* into a single request as long as they are at most POLL_MAX_GAP bytes apart on the wire.
+*/
+//#define MODBUS_POLL
+
+#ifndef POLL_MAX_GAP
+#define POLL_MAX_GAP 16
+#endif
+
+/*
+* Define MODBUS_GATEWAY (requires MODBUS_MASTER) for raw transactions, which pass any request PDU
+* through unchanged, see modbusTransaction. yaMBSlinux.c uses them to forward Modbus TCP requests
+* to an RTU bus, see modbusTcpGateway.
+*/
+//#define MODBUS_GATEWAY
+
+/*
+* Define MODBUS_SECOND_UART to run a second, independent instance (modbusSecondary) on the second
+* USART of the ATmega164P, ATmega328PB or ATmega1284P, see modbusContext. Both buses run at BAUD_SPD
+* with the same configuration. With PHYSICAL_TYPE 485 define SECOND_TRANSCEIVER_ENABLE_PORT,
+* SECOND_TRANSCEIVER_ENABLE_PIN and SECOND_TRANSCEIVER_ENABLE_PORT_DDR for its transceiver.
+*/
+//#define MODBUS_SECOND_UART
+
+#if defined(MODBUS_SECOND_UART) && !defined(SECOND_UART_DATA)
+#error "MODBUS_SECOND_UART: this device has no second USART"
+#endif
+
+#if defined(MODBUS_SECOND_UART) && (PHYSICAL_TYPE == 485) && !defined(SECOND_TRANSCEIVER_ENABLE_PORT)
+#error "MODBUS_SECOND_UART requires SECOND_TRANSCEIVER_ENABLE_PORT, _PIN and _PORT_DDR"
+#endif
+
+#if defined(MODBUS_POLL) && !defined(MODBUS_MASTER)
+#error "MODBUS_POLL requires MODBUS_MASTER"
+#endif
+
+#if defined(MODBUS_GATEWAY) && !defined(MODBUS_MASTER)
+#error "MODBUS_GATEWAY requires MODBUS_MASTER"
+#endif
+
+#if defined(MODBUS_MASTER) && defined(FRAME_QUEUE_DEPTH)
+#error "MODBUS_MASTER and FRAME_QUEUE_DEPTH cannot be combined"
+#endif
+
+#if (FRAME_END_MODE == FRAME_END_PREDICT) && defined(MODBUS_MASTER)
+#error "FRAME_END_PREDICT is for slaves, a master waits for the silence after a response anyway"
+#endif
+
+#if (TIMING_MODE == TIMING_ONESHOT) && defined(MODBUS_MASTER)
+#error "TIMING_ONESHOT is for slaves, a master needs the ticks for its timeouts"
+#endif
+
+#if (TIMING_MODE == TIMING_ONESHOT) && (MODBUS_HAL == HAL_LINUX)
+#error "TIMING_ONESHOT is supported by HAL_AVR and HAL_SIM"
+#endif
+
+#if (TIMING_MODE == TIMING_ONESHOT) && (MODBUS_HAL == HAL_AVR)
+#if defined(attiny3226_init)
+#error "TIMING_ONESHOT: the ATtiny3226 is not supported yet"
+#endif
+#define modbusTimerCountsPerTick (F_CPU/8/1000*timerISROccurenceTime/1000) //Timer1 counts per tick
+#endif
+
+
+/*
+* Frame timing in ticks of timerISROccurenceTime, integers usable in #if. Up to 19200 baud the gaps
+* are measured in characters of modbusBlocksize bits, above they are fixed at 750us (T1.5) and
+* 1750us (T3.5) as the specification demands.
+* modbusInterFrameDelayReceiveStart: silence after which a new frame is accepted, rounded down
+* modbusInterFrameDelayTransmit: silence after which a master sends its next request, at least T3.5
+* even if a tick comes right after the last character
+* modbusInterFrameDelayReceiveEnd: silence that ends a frame, so also the least silence before a
+* response. At least T3.5 (4 characters up to 19200 baud) even if a tick comes right after the
+* last character.
+* modbusInterCharTimeout: time from one received byte to the next that sets GapDetected, at least
+* T1.5 of silence plus the character that ends it. A byte after it discards the frame.
+*/
+#define modbusBlocksize 10
+#if TIMING_MODE == TIMING_ONESHOT
+#define modbusTicksAtLeast(us) (((us)+timerISROccurenceTime-1)/timerISROccurenceTime)
+#else
+#define modbusTicksAtLeast(us) (((us)+timerISROccurenceTime-1)/timerISROccurenceTime+1) //the first tick may follow the character at once
+#endif
+#if BAUD_SPD>19200
+#define modbusT35 1750L
+#define modbusT15 750L
+#define modbusT40 modbusT35
+#else
+#define modbusT35 (35L*modbusBlocksize*100000L/BAUD_SPD) //in microseconds
+#define modbusT15 (15L*modbusBlocksize*100000L/BAUD_SPD)
+#define modbusT40 (40L*modbusBlocksize*100000L/BAUD_SPD)
+#endif
+#define modbusInterFrameDelayReceiveStart (modbusT35/timerISROccurenceTime)
+#define modbusInterFrameDelayTransmit modbusTicksAtLeast(modbusT35)
+#define modbusInterFrameDelayReceiveEnd (modbusT40/timerISROccurenceTime>modbusTicksAtLeast(modbusT35) ? modbusT40/timerISROccurenceTime : modbusTicksAtLeast(modbusT35))
+#define modbusCharacterTime (modbusBlocksize*1000000L/BAUD_SPD)
+#define modbusInterCharTimeout modbusTicksAtLeast(modbusT15+modbusCharacterTime)
+#if modbusInterFrameDelayReceiveStart<1
+#error "timerISROccurenceTime is longer than T3.5 at this BAUD_SPD"
+#endif
+#if (TIMING_MODE == TIMING_ONESHOT) && (MODBUS_HAL == HAL_AVR) && (modbusInterFrameDelayReceiveEnd*modbusTimerCountsPerTick > 65535)
+#error "TIMING_ONESHOT: BAUD_SPD too low for Timer1 at this F_CPU"
+#endif
 
 /**
  * @brief    Modbus Function Codes
@@ -274,9 +680,65 @@ extern "C" {
 #define fcReadInputRegisters 4 //read analog input registers (2 Bytes per register)
 #define fcForceSingleCoil 5 //write single bit
 #define fcPresetSingleRegister 6 //write analog output register (2 Bytes)
+#define fcDiagnostics 8 //serial line diagnostics, see the sub-functions below
 #define fcForceMultipleCoils 15 //write multiple bits
 #define fcPresetMultipleRegisters 16 //write multiple analog output registers (2 Bytes each)
 #define fcReportSlaveID 17 //read device description, run status and other device specific information
+#define fcReadFileRecord 20 //read records (registers) of files, several files per request
+#define fcWriteFileRecord 21 //write records (registers) of files, several files per request
+#define fcMaskWriteRegister 22 //change bits of a single register: (register AND andMask) OR (orMask AND NOT andMask)
+#define fcReadWriteMultipleRegisters 23 //write multiple registers, then read multiple registers
+
+/**
+ * @brief    1 if function code fc is enabled, see MODBUS_FUNCTIONS. Usable in #if as well.
+ */
+#define modbusFunctionEnabled(fc) (((fc)<32) && ((MODBUS_FUNCTIONS>>(fc))&1))
+
+/**
+ * @brief    Size of the largest frame (address to crc) of the enabled function codes.
+ */
+#define modbusLargerOf(a,b) ((a)>(b) ? (a) : (b))
+#define modbusFrameSize(fc,size) (modbusFunctionEnabled(fc) ? (size) : 8)
+#define modbusBitBytes ((MODBUS_MAX_BITS+7)/8)
+#define modbusLargestFrame modbusLargerOf( \
+	modbusLargerOf(modbusFrameSize(fcReadCoilStatus,5+modbusBitBytes),modbusFrameSize(fcReadInputStatus,5+modbusBitBytes)), \
+	modbusLargerOf(modbusLargerOf(modbusFrameSize(fcReadHoldingRegisters,5+2*MODBUS_MAX_REGISTERS),modbusFrameSize(fcReadInputRegisters,5+2*MODBUS_MAX_REGISTERS)), \
+	modbusLargerOf(modbusLargerOf(modbusFrameSize(fcForceMultipleCoils,9+modbusBitBytes),modbusFrameSize(fcPresetMultipleRegisters,9+2*MODBUS_MAX_REGISTERS)), \
+	modbusLargerOf(modbusLargerOf(modbusFrameSize(fcMaskWriteRegister,10),modbusFrameSize(fcReadWriteMultipleRegisters,13+2*MODBUS_MAX_REGISTERS)), \
+	modbusLargerOf(modbusFrameSize(fcReadFileRecord,7+2*MODBUS_MAX_REGISTERS),modbusFrameSize(fcWriteFileRecord,12+2*MODBUS_MAX_REGISTERS))))))
+
+/**
+ * @brief    Defines the maximum Modbus frame size accepted by the device. 255 is the maximum
+ *           value. It is derived from MODBUS_FUNCTIONS, which gives 255 by default, a master
+ *           always uses 255. It might be set to lower values, with 8 being the lowest possible
+ *           value, in order to save on ram space.
+ */
+#ifndef MaxFrameIndex
+#if defined(MODBUS_MASTER) || (modbusLargestFrame>256)
+#define MaxFrameIndex 255
+#else
+#define MaxFrameIndex modbusLargerOf(modbusLargestFrame-1,8)
+#endif
+#endif
+#if (MaxFrameIndex>255) || (MaxFrameIndex<8)
+#error "MaxFrameIndex must be within 8 and 255"
+#endif
+
+/**
+ * @brief    Positions within a frame take a single byte if it has less than 256 of them. The
+ *           timer counts ticks up to modbusInterFrameDelayReceiveEnd, which is less than 256
+ *           down to 2400 baud at 100us. A master keeps 16 bits as its idle time is measured as well.
+ */
+#if MaxFrameIndex<255
+typedef uint8_t modbusFramePos;
+#else
+typedef uint16_t modbusFramePos;
+#endif
+#if !defined(MODBUS_MASTER) && (modbusInterFrameDelayReceiveEnd<256)
+typedef uint8_t modbusTimerCount;
+#else
+typedef uint16_t modbusTimerCount;
+#endif
 
 /**
  * @brief    Modbus Exception Codes
@@ -292,6 +754,20 @@ extern "C" {
 #define ecSlaveDeviceBusy 6
 #define ecNegativeAcknowledge 7
 #define ecMemoryParityError 8
+#define ecGatewayPathUnavailable 10
+#define ecGatewayTargetFailed 11 //the target device failed to respond
+
+/**
+ * @brief    Sub-functions of fcDiagnostics handled by modbusDiagnostics.
+ */
+#define dsReturnQueryData 0 //echoes the request
+#define dsRestartCommunications 1 //clears the counters
+#define dsClearCounters 10
+#define dsBusMessageCount 11
+#define dsBusCommunicationErrorCount 12 //crc errors and frames broken by a gap
+#define dsBusExceptionErrorCount 13
+#define dsSlaveMessageCount 14
+#define dsBusCharacterOverrunCount 18 //overflows and UART overruns
 
 /**
  * @brief    Internal bit definitions
@@ -303,6 +779,20 @@ extern "C" {
 #define TransmitRequested 4
 #define TimerActive 5
 #define GapDetected 6
+#define TransmitHeld 7 //the response waits for the silence after the request, FRAME_END_PREDICT
+
+/**
+ * @brief    Event bit definitions, see MODBUS_EVENTS
+ */
+#define EventFrameReceived 0 //a frame is ready, same as ReceiveCompleted
+#define EventFrameSent 1 //the response has left the transmitter
+#define EventError 2 //a frame has been discarded (crc error, overflow, queue full)
+#define EventWakeup 3 //posted by modbusWakeUp, e.g. from a periodic timer
+
+/**
+ * @brief    All state of a single Modbus instance and the USART it is bound to, see below.
+ */
+typedef struct modbusContext modbusContext;
 
 /**
 * @brief    Configures the UART. Call this function only once.
@@ -310,14 +800,15 @@ extern "C" {
 extern void modbusInit(void);
 
 /**
-* @brief    receive/transmit data array
+* @brief    receive/transmit data array. With FRAME_QUEUE_DEPTH it points to the oldest
+*           frame in the queue.
 */
-extern volatile unsigned char rxbuffer[MaxFrameIndex+1];
+#define rxbuffer (modbusPrimary.buffer)
 
 /**
 * @brief    Current receive/transmit position
 */
-extern volatile uint16_t DataPos;
+#define DataPos (modbusPrimary.dataPos)
 
 /**
  * This only applies to single address mode.
@@ -333,6 +824,18 @@ extern volatile uint16_t DataPos;
 	*         Arguments: - newadr: the new device address
 	*/
 	extern void modbusSetAddress(unsigned char newadr);
+#elif defined(ADDRESS_FILTER)
+	/**
+	* @brief: Accept or reject frames to an address, see ADDRESS_FILTER
+	*         Arguments: - adr: the address (unit), 0 for broadcasts
+	*                    - accept: 1 to accept, 0 to reject
+	*/
+	extern void modbusSetAddressFilter(uint8_t adr, uint8_t accept);
+
+	/**
+	* @brief: 1 if frames to adr are accepted
+	*/
+	extern uint8_t modbusAddressAccepted(uint8_t adr);
 #endif
 
 /* @brief: Sends a response.
@@ -343,6 +846,19 @@ extern volatile uint16_t DataPos;
 */
 extern void modbusSendMessage(unsigned char packtop);
 
+#ifdef ZERO_COPY_TRANSMIT
+/* @brief: Sends a response that consists of rxbuffer[0] to rxbuffer[packtop]
+*          followed by registers which are read directly from ptrToRegisters.
+*
+*         Arguments: - packtop, index of the last byte in rxbuffer
+*                      that belongs to the frame header.
+*                    - ptrToRegisters: registers to be sent after the header,
+*                      high byte first.
+*                    - amount: number of registers
+*/
+extern void modbusSendRegisters(unsigned char packtop, volatile uint16_t *ptrToRegisters, uint8_t amount);
+#endif
+
 /* @brief: Sends a Modbus exception.
 *
 *         Arguments: - exceptionCode
@@ -351,22 +867,463 @@ extern void modbusSendException(unsigned char exceptionCode);
 
 /* @brief: Discards the current transaction. For MULTIPLE_ADR-mode and general
 *		   testing purposes. Call this function if you don't want to reply at all.
+*		   With FRAME_QUEUE_DEPTH this drops the oldest frame from the queue.
 */
 void modbusReset(void);
 
 /**
  * @brief    Call this function whenever possible and check if its return value has the ReceiveCompleted Bit set.
  *           Preferably do this in the main while. I do not recommend calling this function within ISRs.
+ *           With FRAME_QUEUE_DEPTH this also hands the oldest queued frame over to the application.
  * @example  if (modbusGetBusState() & (1<<ReceiveCompleted)) {
  *           modbusSendExcepton(ecIllegalFunction);
  *           }
  */
 extern uint8_t modbusGetBusState(void);
 
+#ifdef MODBUS_MASTER
+/**
+ * @brief    Transaction status
+ */
+#define TransactionOk 0 //finished successfully (or never submitted)
+#define TransactionQueued 1
+#define TransactionBusy 2 //request sent, waiting for the response
+#define TransactionException 3 //the slave responded with exceptionCode
+#define TransactionTimeout 4 //no response within MASTER_RESPONSE_TIMEOUT
+#define TransactionInvalid 5 //the request could not be built or the response did not match it
+#define TransactionOffline 6 //not sent, the slave is considered offline
+
+/**
+ * @brief    A single master request. The structure belongs to the library from
+ *           modbusMasterSubmit until status is neither TransactionQueued nor TransactionBusy.
+ *           data points to registers (uint16_t) for function codes 3, 4, 6 and 16 and
+ *           to bits (uint8_t, starting at bit 0) for function codes 1, 2, 5 and 15.
+ *           Responses to read requests are copied to data unless it is 0. The callback
+ *           may read the response from rxbuffer (buffer of the instance) as well. slave 0 sends a broadcast.
+ *           With MODBUS_GATEWAY and raw set, data points to MaxFrameIndex bytes holding the request
+ *           PDU after the function code, amount is their number. The response PDU after the
+ *           function code replaces them and amount becomes its length.
+ */
+typedef struct modbusTransaction {
+	struct modbusTransaction *next;
+	uint8_t slave;
+	uint8_t function;
+	uint16_t address;
+	uint16_t amount;
+	volatile void *data;
+	volatile uint8_t status;
+	uint8_t exceptionCode;
+	void (*callback)(struct modbusTransaction *t); //called from ISR context when finished, may be 0
+#ifdef MODBUS_GATEWAY
+	uint8_t raw;
+#endif
+} modbusTransaction;
+
+/**
+ * @brief    Queues a request. The bus is served in the order of submission. Returns 0 if
+ *           the transaction is still queued or busy. May also be called from a callback.
+ */
+extern uint8_t modbusMasterSubmit(modbusTransaction *t);
+
+/**
+ * @brief    Returns 1 if the slave is considered offline, see MASTER_SLAVE_SLOTS.
+ */
+extern uint8_t modbusMasterSlaveOffline(uint8_t slave);
+
+/**
+ * @brief    Returns the number of modbusTickTimer calls since modbusInit.
+ */
+extern uint32_t modbusGetTicks(void);
+
+#if MASTER_SLAVE_SLOTS > 0
+/**
+ * @brief    Round trip statistics of a slave, internal
+ */
+typedef struct {
+	uint8_t slave; //0: unused
+	uint8_t failures; //timeouts in a row
+	uint32_t srtt; //smoothed round trip time in ticks * 8, 0: unknown
+	uint32_t rttvar; //round trip time variation in ticks * 4
+	uint32_t backoff; //0: online
+	uint32_t retry; //tick of the next attempt while offline
+} masterSlaveStats;
+#endif
+#endif
+
+#ifdef MODBUS_POLL
+/**
+ * @brief    A data object that is read periodically. function is one of fcReadCoilStatus,
+ *           fcReadInputStatus, fcReadHoldingRegisters or fcReadInputRegisters, data points to
+ *           amount registers (uint16_t) or bits (uint8_t, starting at bit 0). period is given
+ *           in calls of modbusTickTimer. status holds the outcome of the last read.
+ */
+typedef struct {
+	uint8_t slave;
+	uint8_t function;
+	uint16_t address;
+	uint16_t amount;
+	uint32_t period;
+	volatile void *data;
+	volatile uint8_t status;
+	uint32_t due; //internal
+} modbusPollEntry;
+
+/**
+ * @brief    Sets up the poll table. All entries are due immediately.
+ */
+extern void modbusPollInit(modbusPollEntry *entries, uint8_t count);
+
+/**
+ * @brief    Submits the next due read, merged with all reads it can be combined with.
+ *           Call this function whenever possible, it never blocks.
+ */
+extern void modbusPollTask(void);
+#endif
+
+#ifdef MODBUS_EVENTS
+/**
+ * @brief    Event handler, called from ISR context with a single event bit set.
+ *           Keep it short, e.g. set a flag or wake up a task.
+ */
+typedef void (*modbusEventHandler)(uint8_t events);
+
+/**
+ * @brief    Installs an event handler. Pass 0 to remove it.
+ */
+extern void modbusSetEventHandler(modbusEventHandler handler);
+
+/**
+ * @brief    Returns all events posted since the last call and clears them. Leaves the
+ *           interrupt state as it is.
+ */
+extern uint8_t modbusGetEvents(void);
+
+/**
+ * @brief    Puts the cpu to sleep (sleep_cpu) until an event is pending, then returns and
+ *           clears all pending events. Select a sleep mode that keeps the UART and the
+ *           timer calling modbusTickTimer running (e.g. SLEEP_MODE_IDLE). Interrupts are enabled
+ *           while sleeping, on return they are as the caller had them.
+ * @example  while(1) {
+ *               modbusWaitForEvent();
+ *               while (modbusGetBusState() & (1<<ReceiveCompleted)) modbusGet();
+ *           }
+ *           It only returns on bus events, on an idle bus that is never: call modbusWakeUp
+ *           periodically if the loop has other work, e.g. resetting the watchdog.
+ */
+extern uint8_t modbusWaitForEvent(void);
+
+/**
+ * @brief    Posts EventWakeup, modbusWaitForEvent returns. Call from an ISR.
+ */
+extern void modbusWakeUp(void);
+#endif
+
+#ifdef MODBUS_DIAGNOSTICS
+/**
+ * @brief    Counters of MODBUS_DIAGNOSTICS. They wrap around at 65536 like the ones of
+ *           fcDiagnostics and start at 0 on modbusInit, modbusClearCounters or the
+ *           sub-functions dsRestartCommunications and dsClearCounters.
+ */
+typedef struct {
+	uint16_t busMessages; //frames that started on the bus, for any address
+	uint16_t crcErrors; //frames discarded for a crc error or a gap of more than T1.5 within the frame
+	uint16_t exceptions; //exception responses sent
+	uint16_t slaveMessages; //frames handed over to the application
+	uint16_t overflows; //frames discarded for being longer than rxbuffer or for a full frame queue
+	uint16_t addressMismatches; //frames for other addresses, slaves only
+	uint16_t framingErrors; //characters without a proper stop bit (UART)
+	uint16_t uartOverruns; //characters lost because the receive ISR came too late (UART)
+} modbusCounters;
+
+/**
+ * @brief    Copies the counters to counters.
+ */
+extern void modbusGetCounters(modbusCounters *counters);
+
+/**
+ * @brief    Sets all counters to 0.
+ */
+extern void modbusClearCounters(void);
+
+/**
+ * @brief    Answers fcDiagnostics with the counters: dsBusMessageCount,
+ *           dsBusCommunicationErrorCount, dsBusExceptionErrorCount, dsSlaveMessageCount and
+ *           dsBusCharacterOverrunCount (overflows and uartOverruns), dsClearCounters and
+ *           dsRestartCommunications clear them, dsReturnQueryData echoes the request. Other
+ *           sub-functions are answered with ecIllegalFunction. Returns 1 for a proper response.
+ */
+extern uint8_t modbusDiagnostics(void);
+#endif
+
+#ifdef FRAME_QUEUE_DEPTH
+#if FRAME_QUEUE_DEPTH < 2
+#error "FRAME_QUEUE_DEPTH must be at least 2"
+#endif
+#endif
+
+#if MODBUS_HAL == HAL_AVR
+/**
+ * @brief    The USART an instance is bound to, set up by the library.
+ */
+typedef struct {
+#if defined(attiny3226_init)
+	USART_t *usart;
+#else
+	volatile uint8_t *data; //UDRn
+	volatile uint8_t *status; //UCSRnA
+	volatile uint8_t *control; //UCSRnB
+	volatile uint8_t *format; //UCSRnC
+	volatile uint8_t *baudHigh; //UBRRnH
+	volatile uint8_t *baudLow; //UBRRnL
+#endif
+	uint16_t baud; //value of the baud rate register
+#if PHYSICAL_TYPE == 485
+	volatile uint8_t *txenPort;
+	volatile uint8_t *txenDdr;
+	uint8_t txenMask;
+#endif
+#if TIMING_MODE == TIMING_ONESHOT
+	uint16_t timerBase; //TCNT1 when the timer of the instance was restarted
+#endif
+} modbusUart;
+#elif MODBUS_HAL == HAL_LINUX
+/**
+ * @brief    The serial device an instance is bound to, see modbusLinuxOpen.
+ */
+typedef struct {
+	int fd;
+	int peerFd; //slave side of a pseudo terminal opened by modbusLinuxOpenPty, -1 otherwise
+	void (*direction)(modbusContext *ctx, uint8_t transmit); //switches an external transceiver, may be 0
+	uint8_t wire; //internal: 0 for pseudo terminals, which transmit instantly
+	uint8_t txPending;
+	uint8_t txActive;
+	uint16_t txLength;
+	uint16_t txSent;
+	uint64_t txEnd;
+	unsigned char txBuffer[MaxFrameIndex+1];
+} modbusUart;
+#elif MODBUS_HAL == HAL_SIM
+/**
+ * @brief    The place of an instance on a simulated bus, see modbusSimAttach.
+ */
+typedef struct {
+	struct modbusSimBus *bus;
+	void (*poll)(modbusContext *ctx); //main loop of the node
+	uint32_t pollPeriod; //ns between two calls of poll, 0: after every event
+	uint64_t nextPoll;
+	uint64_t nextTick;
+	uint8_t node; //index on the bus
+	uint8_t driver; //transceiver switched to transmit, which also disables the receiver
+	uint8_t txRequested;
+	uint8_t sending; //a character of the instance is on the bus
+#if TIMING_MODE == TIMING_ONESHOT
+	uint64_t timerBase;
+	uint64_t timerDeadline; //0: not armed
+#endif
+} modbusUart;
+#endif
+
+/**
+ * @brief    A Modbus instance. Every USART gets its own instance, its ISRs work on it
+ *           and nothing else: modbusPrimary is bound to the USART selected above,
+ *           modbusSecondary to the second one (see MODBUS_SECOND_UART). All members
+ *           are internal except for buffer, which is rxbuffer of the instance.
+ */
+struct modbusContext {
+	modbusUart uart;
+	volatile unsigned char busState;
+	volatile modbusTimerCount timer;
+	volatile modbusFramePos dataPos;
+	volatile unsigned char packetTopIndex;
+	volatile uint16_t dataAmount;
+	volatile uint16_t dataLocation;
+#if ADDRESS_MODE == SINGLE_ADR
+	volatile unsigned char address;
+#elif defined(ADDRESS_FILTER)
+	volatile uint8_t addressFilter[32]; //bit adr&7 of byte adr>>3 for every accepted address
+#endif
+#ifdef CRC_ON_RECEIVE
+	volatile uint16_t rxCrc;
+#endif
+#if FRAME_END_MODE == FRAME_END_PREDICT
+	volatile modbusFramePos rxExpected; //predicted length of the frame being received, 0: unknown
+#endif
+#ifdef ZERO_COPY_TRANSMIT
+	volatile uint16_t txCrc;
+	volatile uint16_t *txRegisters;
+	volatile unsigned char txHeaderTop;
+	volatile unsigned char txPayloadTop;
+#endif
+#ifdef MODBUS_EVENTS
+	volatile uint8_t events;
+	modbusEventHandler eventHandler;
+#endif
+#ifdef MODBUS_DIAGNOSTICS
+	volatile modbusCounters counters;
+#endif
+#ifdef MODBUS_MASTER
+	modbusTransaction *masterQueueHead;
+	modbusTransaction *masterQueueTail;
+	modbusTransaction * volatile masterCurrent;
+	volatile unsigned char masterState;
+	volatile uint16_t masterTimeout;
+	uint16_t masterTimeoutStart;
+	volatile uint32_t ticks;
+#if MASTER_SLAVE_SLOTS > 0
+	masterSlaveStats *masterStats; //slave addressed by the current transaction
+	masterSlaveStats masterSlaves[MASTER_SLAVE_SLOTS];
+#endif
+#endif
+#ifdef MODBUS_POLL
+	modbusPollEntry *pollEntries;
+	uint8_t pollCount;
+	modbusTransaction pollTransaction;
+#endif
+#ifdef FRAME_QUEUE_DEPTH
+	volatile unsigned char queueHead; //frame being received, written by ISRs only
+	volatile unsigned char queueTail; //oldest completed frame, written by the consumer only
+	volatile unsigned char queueFrameTaken;
+	volatile modbusFramePos rxPos;
+	volatile unsigned char *rxFrame;
+	volatile unsigned char * volatile buffer;
+	volatile modbusFramePos frameLength[FRAME_QUEUE_DEPTH];
+	volatile unsigned char queue[FRAME_QUEUE_DEPTH][MaxFrameIndex+1];
+	volatile unsigned char txFrame[MaxFrameIndex+1]; //response being sent, see modbusTransmitRequest
+#else
+	volatile unsigned char buffer[MaxFrameIndex+1];
+#endif
+#if MODBUS_HAL != HAL_AVR
+	unsigned char framing; //FramingRtu or FramingTcp, set before modbusCtxInit
+#endif
+};
+
+extern modbusContext modbusPrimary;
+#ifdef MODBUS_SECOND_UART
+extern modbusContext modbusSecondary;
+#endif
+
+/**
+ * @brief    File record handler for modbusExchangeFileRecords, called once per record range
+ *           of a request: length registers from record of file, in Modbus byte order (high
+ *           byte first) at data, which points into rxbuffer. For reads (write 0) the handler
+ *           fills in the 2*length bytes, e.g. straight from flash or eeprom, for writes it
+ *           takes them from there. Records are numbered 0 to 9999 (modbusFileMaxRecord).
+ *           Returns 0 or an exception code, e.g. ecIllegalDataAddress for a file or records
+ *           it does not have, which is sent instead of the response. Record ranges of a write
+ *           handled before the failing one have been written already.
+ */
+typedef uint8_t (*modbusFileHandler)(uint16_t file, uint16_t record, volatile uint8_t *data, uint8_t length, uint8_t write);
+#define modbusFileReferenceType 6 //the only one defined
+#define modbusFileMaxRecord 9999
+
+/**
+ * @brief    Instance API. Every function of the single instance API has a counterpart
+ *           prefixed with modbusCtx that takes the instance as its first argument, e.g.
+ *           modbusCtxGetBusState(&modbusSecondary). The single instance API works on
+ *           modbusPrimary. Call modbusCtxTickTimer for every instance in the timer ISR.
+ */
+extern void modbusCtxInit(modbusContext *ctx);
+#if TIMING_MODE == TIMING_TICK
+extern void modbusCtxTickTimer(modbusContext *ctx);
+#endif
+extern uint8_t modbusCtxGetBusState(modbusContext *ctx);
+extern void modbusCtxReset(modbusContext *ctx);
+extern void modbusCtxSendMessage(modbusContext *ctx, unsigned char packtop);
+extern void modbusCtxSendException(modbusContext *ctx, unsigned char exceptionCode);
+extern uint16_t modbusCtxRequestedAmount(modbusContext *ctx);
+extern uint16_t modbusCtxRequestedAddress(modbusContext *ctx);
+extern uint16_t modbusCtxRequestedWriteAmount(modbusContext *ctx);
+extern uint16_t modbusCtxRequestedWriteAddress(modbusContext *ctx);
+extern uint8_t modbusCtxIsInRange(modbusContext *ctx, uint16_t adr);
+extern uint8_t modbusCtxIsRangeInRange(modbusContext *ctx, uint16_t startAdr, uint16_t lastAdr);
+extern uint8_t modbusCtxExchangeBits(modbusContext *ctx, volatile uint8_t *ptrToInArray, uint16_t startAddress, uint16_t size);
+extern uint8_t modbusCtxExchangeBitsInRange(modbusContext *ctx, volatile uint8_t *ptrToInArray, uint16_t startAddress);
+extern uint8_t modbusCtxExchangeFileRecords(modbusContext *ctx, modbusFileHandler handler);
+#ifdef MODBUS_DIAGNOSTICS
+extern void modbusCtxGetCounters(modbusContext *ctx, modbusCounters *counters);
+extern void modbusCtxClearCounters(modbusContext *ctx);
+extern uint8_t modbusCtxDiagnostics(modbusContext *ctx);
+#endif
+extern uint8_t modbusCtxExchangeRegisters(modbusContext *ctx, volatile uint16_t *ptrToInArray, uint16_t startAddress, uint16_t size);
+extern uint8_t modbusCtxExchangeRegistersInRange(modbusContext *ctx, volatile uint16_t *ptrToInArray, uint16_t startAddress);
+#if ADDRESS_MODE == SINGLE_ADR
+extern uint8_t modbusCtxGetAddress(modbusContext *ctx);
+extern void modbusCtxSetAddress(modbusContext *ctx, unsigned char newadr);
+#elif defined(ADDRESS_FILTER)
+extern void modbusCtxSetAddressFilter(modbusContext *ctx, uint8_t adr, uint8_t accept);
+extern uint8_t modbusCtxAddressAccepted(modbusContext *ctx, uint8_t adr);
+#endif
+#ifdef ZERO_COPY_TRANSMIT
+extern void modbusCtxSendRegisters(modbusContext *ctx, unsigned char packtop, volatile uint16_t *ptrToRegisters, uint8_t amount);
+#endif
+#ifdef MODBUS_MASTER
+extern uint8_t modbusCtxMasterSubmit(modbusContext *ctx, modbusTransaction *t);
+extern uint8_t modbusCtxMasterSlaveOffline(modbusContext *ctx, uint8_t slave);
+extern uint32_t modbusCtxGetTicks(modbusContext *ctx);
+#endif
+#ifdef MODBUS_POLL
+extern void modbusCtxPollInit(modbusContext *ctx, modbusPollEntry *entries, uint8_t count);
+extern void modbusCtxPollTask(modbusContext *ctx);
+#endif
+#ifdef MODBUS_EVENTS
+extern void modbusCtxSetEventHandler(modbusContext *ctx, modbusEventHandler handler);
+extern uint8_t modbusCtxGetEvents(modbusContext *ctx);
+extern uint8_t modbusCtxWaitForEvent(modbusContext *ctx);
+extern void modbusCtxWakeUp(modbusContext *ctx);
+#endif
+
+#if MODBUS_HAL != HAL_AVR
+/**
+ * @brief    Hardware abstraction. A backend other than HAL_AVR implements the modbusHal
+ *           functions, which are called by the core, and calls the modbusCtx functions
+ *           below from its interrupts or event loop, just like the AVR ISRs do.
+ */
+extern void modbusHalInit(modbusContext *ctx); //set up the UART of ctx
+extern void modbusHalStartTransmit(modbusContext *ctx); //call modbusCtxTransmitByte until modbusCtxTransmitDone
+extern void modbusHalTransceiver(modbusContext *ctx, uint8_t transmit); //switch the direction pin
+#ifdef MODBUS_EVENTS
+extern void modbusHalIdle(void); //wait for anything to happen
+#endif
+#if TIMING_MODE == TIMING_ONESHOT
+extern void modbusHalTimerStart(modbusContext *ctx); //restart the timer of ctx at 0
+extern void modbusHalTimerArm(modbusContext *ctx, uint16_t ticks); //call modbusCtxTimerExpired ticks*100us after the restart, 0: never
+#endif
+
+/**
+ * @brief    Events of the backend: a byte has been received, the UART is ready for the
+ *           next byte (returns it), modbusCtxTransmitDone returns 1 after the last one, the
+ *           last byte has left the transmitter. Call modbusCtxTickTimer every 100us.
+ */
+extern void modbusCtxReceiveByte(modbusContext *ctx, uint8_t data);
+extern uint8_t modbusCtxTransmitByte(modbusContext *ctx);
+extern uint8_t modbusCtxTransmitDone(modbusContext *ctx);
+extern void modbusCtxTransmitComplete(modbusContext *ctx);
+#if TIMING_MODE == TIMING_ONESHOT
+extern void modbusCtxTimerExpired(modbusContext *ctx); //the time given to modbusHalTimerArm has come
+#endif
+
+/**
+ * @brief    Framings of an instance. The PDU handlers only look at the address (unit) and
+ *           the PDU in buffer, the framing decides what surrounds them on the wire.
+ *           An instance with FramingTcp is fed with whole frames by modbusCtxReceiveFrame
+ *           and its responses are sent without crc, the backend adds the MBAP header.
+ */
+#define FramingRtu 0
+#define FramingTcp 1
+
+/**
+ * @brief    Hands a complete request, address (unit) followed by the PDU, to the application
+ *           just like a frame received by the UART. For instances with FramingTcp.
+ */
+extern void modbusCtxReceiveFrame(modbusContext *ctx, const uint8_t *frame, uint8_t length);
+#endif
+
+#if TIMING_MODE == TIMING_TICK
 /**
  * @brief    Call every 100us using a timer ISR.
  */
 extern void modbusTickTimer(void);
+#endif
 
 /**
  * @brief    Returns amount of bits/registers requested.
@@ -378,12 +1335,52 @@ extern uint16_t modbusRequestedAmount(void);
  */
 extern uint16_t modbusRequestedAddress(void);
 
+/**
+ * @brief    Amount and address of the registers written by fcReadWriteMultipleRegisters,
+ *           modbusRequestedAmount and modbusRequestedAddress give the ones read.
+ */
+extern uint16_t modbusRequestedWriteAmount(void);
+extern uint16_t modbusRequestedWriteAddress(void);
+
 /* A fairly simple and hopefully Modbus compliant 16 Bit CRC algorithm.
 *  Returns 1 if the crc check is positive, returns 0 if it fails.
 *  Appends two crc bytes to the array.
 */
 extern uint8_t crc16(volatile uint8_t *ptrToArray,uint8_t inputSize);
 
+/* @brief: Feeds a single byte into a running crc. Start with 0xFFFF.
+*
+*         Arguments: - crc: crc over all previous bytes
+*                    - data: next byte
+*/
+extern uint16_t crc16Update(uint16_t crc, uint8_t data);
+
+/* @brief: Returns the crc of ptrToArray[0] to ptrToArray[inputSize] without
+*          touching the array.
+*/
+extern uint16_t crc16Compute(volatile uint8_t *ptrToArray,uint8_t inputSize);
+
+/* @brief: Appends the crc of ptrToArray[0] to ptrToArray[inputSize] at
+*          ptrToArray[inputSize+1] (Lo) and ptrToArray[inputSize+2] (Hi).
+*/
+extern void crc16Append(volatile uint8_t *ptrToArray,uint8_t inputSize);
+
+/* @brief: Copies a single bit from one array of chars to another one.
+*
+*         Arguments: - source, sourceNr: source array and number of the bit within it
+*                    - target, targetNr: target array and number of the bit within it
+*/
+extern void listBitCopy(volatile uint8_t *source, uint16_t sourceNr,volatile uint8_t *target, uint16_t targetNr);
+
+/* @brief: Copies amount bits from one array of chars to another one. Whole bytes are
+*          moved at once, only the bits at both ends of the range are copied one by one.
+*
+*         Arguments: - source, sourceNr: source array and number of the first bit within it
+*                    - target, targetNr: target array and number of the first bit within it
+*                    - amount: number of bits
+*/
+extern void listBitRangeCopy(volatile uint8_t *source, uint16_t sourceNr, volatile uint8_t *target, uint16_t targetNr, uint16_t amount);
+
 /* @brief: Handles single/multiple input/coil reading and single/multiple coil writing.
 *
 *         Arguments: - ptrToInArray: pointer to the user's data array containing bits
@@ -402,6 +1399,13 @@ extern uint8_t modbusExchangeBits(volatile uint8_t *ptrToInArray, uint16_t start
 */
 extern uint8_t modbusExchangeRegisters(volatile uint16_t *ptrToInArray, uint16_t startAddress, uint16_t size);
 
+/* @brief: Handles file record reading (fcReadFileRecord) and writing (fcWriteFileRecord) by
+*          calling handler once per record range of the request, see modbusFileHandler. The
+*          whole request is checked before the first call.
+*
+*/
+extern uint8_t modbusExchangeFileRecords(modbusFileHandler handler);
+
 /* @brief: returns 1 if data location adr is touched by current command
 *
 *         Arguments: - adr: address of the data object
@@ -417,8 +1421,8 @@ extern uint8_t modbusIsInRange(uint16_t adr);
 */
 extern uint8_t modbusIsRangeInRange(uint16_t startAdr, uint16_t lastAdr);
 
-extern volatile uint16_t modbusDataAmount;
-extern volatile uint16_t modbusDataLocation;
+#define modbusDataAmount (modbusPrimary.dataAmount)
+#define modbusDataLocation (modbusPrimary.dataLocation)
 
 #ifdef __cplusplus
 }
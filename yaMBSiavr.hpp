@@ -0,0 +1,177 @@
+#ifndef yaMBIavr_HPP
+#define yaMBIavr_HPP
+/************************************************************************
+Title:    Yet another (small) Modbus (server) implementation for the avr.
+          Header-only C++ front end.
+Author:   Max Brueggemann
+Hardware: any AVR with hardware UART, tested on Atmega 88/168 at 20Mhz
+License:  BSD-3-Clause
+
+LICENSE:
+
+Copyright 2017 Max Brueggemann, www.maxbrueggemann.de
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+THE POSSIBILITY OF SUCH DAMAGE.
+
+************************************************************************/
+#include "yaMBSiavr.h"
+
+/**
+ *  @code #include <yaMBSiavr.hpp> @endcode
+ *
+ *  @brief   Compile time register map. Declare your data objects as tables bound to
+ *           global variables and let the compiler generate the function code switch that
+ *           would otherwise be written by hand (see example/example.c):
+ *
+ *           typedef yaMBS::Map<
+ *               yaMBS::Coils<0,8,&outstate>,
+ *               yaMBS::HoldingRegisters<0,4,holdingRegisters>,
+ *               yaMBS::InputRegisters<0,4,inputRegisters>
+ *           > RegisterMap;
+ *
+ *           if (modbusGetBusState() & (1<<ReceiveCompleted)) RegisterMap::handle();
+ *
+ *           Function codes without a matching table are answered with ecIllegalFunction,
+ *           requests that are not covered by a single table with ecIllegalDataAddress.
+ *           Requires C++11 (avr-g++ -std=c++11 or later).
+ */
+namespace yaMBS {
+
+/**
+ * @brief    Data object kinds, each one is served by its own set of function codes.
+ */
+enum Kind { kindCoil, kindDiscreteInput, kindInputRegister, kindHoldingRegister };
+
+/**
+ * @brief    Common part of all tables. Start is the address of the first data
+ *           object, Size the number of data objects (bits or registers).
+ */
+template<Kind K, uint16_t Start, uint16_t Size>
+struct Table {
+	static const Kind kind = K;
+	static_assert(Size > 0, "empty table");
+	static_assert((uint32_t)Start + Size <= 0x10000UL, "table exceeds the address space");
+
+	static inline bool covers(uint16_t adr, uint16_t amount) {
+		return (adr >= Start) && (amount <= Size) && ((uint16_t)(adr - Start) <= (uint16_t)(Size - amount));
+	}
+};
+
+template<uint16_t Start, uint16_t Size, volatile uint8_t *Bits>
+struct Coils : Table<kindCoil, Start, Size> {
+	static inline uint8_t exchange(void) { return modbusCtxExchangeBitsInRange(&modbusPrimary, Bits, Start); }
+};
+
+template<uint16_t Start, uint16_t Size, volatile uint8_t *Bits>
+struct DiscreteInputs : Table<kindDiscreteInput, Start, Size> {
+	static inline uint8_t exchange(void) { return modbusCtxExchangeBitsInRange(&modbusPrimary, Bits, Start); }
+};
+
+template<uint16_t Start, uint16_t Size, volatile uint16_t *Registers>
+struct InputRegisters : Table<kindInputRegister, Start, Size> {
+	static inline uint8_t exchange(void) { return modbusCtxExchangeRegistersInRange(&modbusPrimary, Registers, Start); }
+};
+
+template<uint16_t Start, uint16_t Size, volatile uint16_t *Registers>
+struct HoldingRegisters : Table<kindHoldingRegister, Start, Size> {
+	static inline uint8_t exchange(void) { return modbusCtxExchangeRegistersInRange(&modbusPrimary, Registers, Start); }
+};
+
+/**
+ * @brief    Walks all tables of kind K at compile time. The result is a chain of
+ *           range checks for exactly those tables, all others are skipped by the compiler.
+ *           The table that covers the request answers it without checking the range again.
+ */
+template<Kind K, class... Tables>
+struct Select;
+
+template<Kind K>
+struct Select<K> {
+	static const bool any = false;
+	static inline uint8_t exchange(uint16_t, uint16_t, uint16_t, uint16_t) {
+		modbusSendException(ecIllegalDataAddress);
+		return 0;
+	}
+};
+
+template<Kind K, class First, class... Rest>
+struct Select<K, First, Rest...> {
+	static const bool any = (First::kind == K) || Select<K, Rest...>::any;
+	static inline uint8_t exchange(uint16_t adr, uint16_t amount, uint16_t writeAdr, uint16_t writeAmount) {
+		if ((First::kind == K) && First::covers(adr, amount) && First::covers(writeAdr, writeAmount)) return First::exchange();
+		return Select<K, Rest...>::exchange(adr, amount, writeAdr, writeAmount);
+	}
+};
+
+/**
+ * @brief    The register map. handle() answers the request in rxbuffer and returns 1
+ *           if it has been served, 0 if an exception has been sent instead.
+ */
+template<class... Tables>
+struct Map {
+	template<Kind K>
+	static inline uint8_t serve(void) {
+		if (!Select<K, Tables...>::any) { //resolved at compile time
+			modbusSendException(ecIllegalFunction);
+			return 0;
+		}
+		uint16_t adr = modbusRequestedAddress(), amount = modbusRequestedAmount();
+		if (rxbuffer[1] == fcReadWriteMultipleRegisters) //both ranges in the same table
+			return Select<K, Tables...>::exchange(adr, amount, modbusRequestedWriteAddress(), modbusRequestedWriteAmount());
+		return Select<K, Tables...>::exchange(adr, amount, adr, amount);
+	}
+
+	static uint8_t handle(void) {
+		switch (rxbuffer[1]) {
+			case fcReadCoilStatus:
+			case fcForceSingleCoil:
+			case fcForceMultipleCoils:
+				return serve<kindCoil>();
+
+			case fcReadInputStatus:
+				return serve<kindDiscreteInput>();
+
+			case fcReadInputRegisters:
+				return serve<kindInputRegister>();
+
+			case fcReadHoldingRegisters:
+			case fcPresetSingleRegister:
+			case fcPresetMultipleRegisters:
+			case fcMaskWriteRegister:
+			case fcReadWriteMultipleRegisters:
+				return serve<kindHoldingRegister>();
+
+			default:
+				modbusSendException(ecIllegalFunction);
+				return 0;
+		}
+	}
+};
+
+} //namespace yaMBS
+
+#endif
@@ -0,0 +1,1001 @@
+/************************************************************************
+Title:    Yet another (small) Modbus (server) implementation for the avr.
+          Linux backend.
+Author:   Max Brueggemann
+Hardware: serial devices and pseudo terminals under Linux
+License:  BSD-3-Clause
+
+LICENSE:
+
+Copyright 2017 Max Brueggemann, www.maxbrueggemann.de
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+THE POSSIBILITY OF SUCH DAMAGE.
+
+************************************************************************/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include "yaMBSlinux.h"
+
+#if MODBUS_HAL != HAL_LINUX
+#error "build yaMBSlinux.c and yaMBSiavr.c with -DMODBUS_HAL=HAL_LINUX"
+#endif
+
+#define linuxTickTime timerISROccurenceTime //microseconds between two calls of modbusCtxTickTimer
+#define linuxCharTime (10*1000000UL/BAUD_SPD) //microseconds per character (8N1)
+
+static modbusContext *linuxContexts[LINUX_MAX_CONTEXTS];
+static uint8_t linuxContextCount = 0;
+static uint64_t linuxLastTick = 0;
+static modbusTcpServer *linuxServers[LINUX_MAX_SERVERS];
+static uint8_t linuxServerCount = 0;
+
+uint64_t modbusLinuxMicros(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC,&now);
+	return (uint64_t)now.tv_sec*1000000+now.tv_nsec/1000;
+}
+
+/* @brief: Returns the termios constant for BAUD_SPD.
+*
+*/
+static speed_t modbusLinuxSpeed(void)
+{
+	switch (BAUD_SPD)
+	{
+		case 1200: return B1200;
+		case 2400: return B2400;
+		case 4800: return B4800;
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		case 460800: return B460800;
+		case 921600: return B921600;
+		default: return B0;
+	}
+}
+
+/* @brief: Puts fd into raw mode, 8N1 at BAUD_SPD, non-blocking.
+*
+*/
+static int modbusLinuxRaw(int fd)
+{
+	struct termios tio;
+	if (tcgetattr(fd,&tio)<0) return -1;
+	cfmakeraw(&tio);
+	tio.c_cflag|=CLOCAL|CREAD;
+	tio.c_cflag&=~(CSTOPB|PARENB|CRTSCTS);
+	tio.c_cc[VMIN]=0;
+	tio.c_cc[VTIME]=0;
+	if (modbusLinuxSpeed()==B0) {
+		errno=EINVAL;
+		return -1;
+	}
+	cfsetispeed(&tio,modbusLinuxSpeed());
+	cfsetospeed(&tio,modbusLinuxSpeed());
+	if (tcsetattr(fd,TCSANOW,&tio)<0) return -1;
+	return fcntl(fd,F_SETFL,fcntl(fd,F_GETFL)|O_NONBLOCK);
+}
+
+void modbusHalInit(modbusContext *ctx)
+{
+	uint8_t c;
+	ctx->uart.txPending=0;
+	ctx->uart.txActive=0;
+	if (ctx->framing==FramingTcp) return; //fed by its server, no device and no ticks
+	for (c=0; c<linuxContextCount; c++)
+	{
+		if (linuxContexts[c]==ctx) return;
+	}
+	if (linuxContextCount<LINUX_MAX_CONTEXTS) linuxContexts[linuxContextCount++]=ctx;
+	if (!linuxLastTick) linuxLastTick=modbusLinuxMicros();
+}
+
+void modbusHalStartTransmit(modbusContext *ctx)
+{
+	ctx->uart.txPending=1;
+}
+
+void modbusHalTransceiver(modbusContext *ctx, uint8_t transmit)
+{
+	if (ctx->uart.direction) ctx->uart.direction(ctx,transmit);
+}
+
+#ifdef MODBUS_EVENTS
+void modbusHalIdle(void)
+{
+	modbusLinuxPoll(-1);
+}
+#endif
+
+/* @brief: Binds ctx to fd and initializes it.
+*
+*/
+static int modbusLinuxBind(modbusContext *ctx, int fd, int peerFd, uint8_t wire)
+{
+	if (linuxContextCount>=LINUX_MAX_CONTEXTS) {
+		errno=ENOSPC;
+		return -1;
+	}
+	if (modbusLinuxRaw(fd)<0) return -1;
+	ctx->uart.fd=fd;
+	ctx->uart.peerFd=peerFd;
+	ctx->uart.direction=0;
+	ctx->uart.wire=wire;
+	modbusCtxInit(ctx);
+	return 0;
+}
+
+int modbusLinuxOpen(modbusContext *ctx, const char *device)
+{
+	int fd=open(device,O_RDWR|O_NOCTTY|O_NONBLOCK);
+	if (fd<0) return -1;
+	if (modbusLinuxBind(ctx,fd,-1,strncmp(device,"/dev/pts/",9)!=0)<0) {
+		int e=errno;
+		close(fd);
+		errno=e;
+		return -1;
+	}
+	return 0;
+}
+
+int modbusLinuxOpenPty(modbusContext *ctx, char *peer, size_t size)
+{
+	int fd=posix_openpt(O_RDWR|O_NOCTTY|O_NONBLOCK);
+	int peerFd=-1;
+	if (fd<0) return -1;
+	if ((grantpt(fd)<0) || (unlockpt(fd)<0) || ptsname_r(fd,peer,size)) goto fail;
+	peerFd=open(peer,O_RDWR|O_NOCTTY|O_NONBLOCK); //keeps the pair alive and raw until the peer shows up
+	if ((peerFd<0) || (modbusLinuxRaw(peerFd)<0)) goto fail;
+	if (modbusLinuxBind(ctx,fd,peerFd,0)<0) goto fail;
+	return 0;
+fail:
+	{
+		int e=errno;
+		if (peerFd>=0) close(peerFd);
+		close(fd);
+		errno=e;
+	}
+	return -1;
+}
+
+void modbusLinuxClose(modbusContext *ctx)
+{
+	for (uint8_t c=0; c<linuxContextCount; c++)
+	{
+		if (linuxContexts[c]!=ctx) continue;
+		linuxContexts[c]=linuxContexts[--linuxContextCount];
+		if (ctx->uart.peerFd>=0) close(ctx->uart.peerFd);
+		close(ctx->uart.fd);
+		ctx->uart.fd=-1;
+		ctx->uart.peerFd=-1;
+		return;
+	}
+}
+
+/* @brief: returns 1 if ctx has to be ticked in time, i.e. something is going on
+*
+*/
+static uint8_t modbusLinuxBusy(modbusContext *ctx)
+{
+	if (ctx->uart.txPending || ctx->uart.txActive) return 1;
+	if (!(ctx->busState&(1<<BusTimedOut)) || (ctx->busState&((1<<Receiving)|(1<<TransmitRequested)|(1<<Transmitting)))) return 1;
+	#ifdef MODBUS_MASTER
+	if (ctx->masterCurrent || ctx->masterQueueHead) return 1;
+	#endif
+	return 0;
+}
+
+/* @brief: Accounts for count ticks of an idle instance at once. Only the thresholds of the
+*          timer still ahead are ticked one by one, the rest just advances the tick count.
+*
+*/
+static void modbusLinuxSkipTicks(modbusContext *ctx, uint64_t count)
+{
+	while (count && (ctx->busState&(1<<TimerActive)) && (ctx->timer<modbusInterFrameDelayReceiveEnd))
+	{
+		modbusCtxTickTimer(ctx);
+		count--;
+	}
+	#ifdef MODBUS_MASTER
+	ctx->ticks+=(uint32_t)count;
+	#endif
+}
+
+/* @brief: Calls modbusCtxTickTimer for every tick that has passed since the last call. After
+*          an idle wait without timeout the instances with nothing going on catch up in one step.
+*
+*/
+static void modbusLinuxTick(void)
+{
+	uint64_t now=modbusLinuxMicros();
+	uint64_t count=(now-linuxLastTick)/linuxTickTime;
+	if (!count) return;
+	linuxLastTick+=count*linuxTickTime;
+	for (uint8_t c=0; c<linuxContextCount; c++)
+	{
+		modbusContext *ctx=linuxContexts[c];
+		if (!modbusLinuxBusy(ctx)) modbusLinuxSkipTicks(ctx,count);
+		else for (uint64_t n=0; n<count; n++) modbusCtxTickTimer(ctx);
+	}
+}
+
+/* @brief: Reads everything that has been received so far.
+*
+*/
+static int modbusLinuxReceive(modbusContext *ctx)
+{
+	unsigned char data[256];
+	ssize_t n;
+	while ((n=read(ctx->uart.fd,data,sizeof(data)))>0)
+	{
+		for (ssize_t c=0; c<n; c++) modbusCtxReceiveByte(ctx,data[c]);
+	}
+	if ((n<0) && (errno!=EAGAIN) && (errno!=EWOULDBLOCK) && (errno!=EIO)) return -1; //EIO: the peer of a pty has gone
+	return 0;
+}
+
+/* @brief: Fetches a pending frame from the core, writes it and reports its end once the
+*          last byte has (at least in theory) left the wire.
+*
+*/
+static int modbusLinuxTransmit(modbusContext *ctx)
+{
+	modbusUart *uart=&ctx->uart;
+	int queued=0;
+	if (uart->txPending && !uart->txActive)
+	{
+		uart->txPending=0;
+		uart->txLength=0;
+		uart->txSent=0;
+		do {
+			uart->txBuffer[uart->txLength++]=modbusCtxTransmitByte(ctx);
+		} while (!modbusCtxTransmitDone(ctx) && (uart->txLength<sizeof(uart->txBuffer)));
+		uart->txEnd=modbusLinuxMicros();
+		if (uart->wire) uart->txEnd+=uart->txLength*linuxCharTime;
+		uart->txActive=1;
+	}
+	if (!uart->txActive) return 0;
+	if (uart->txSent<uart->txLength)
+	{
+		ssize_t n=write(uart->fd,uart->txBuffer+uart->txSent,uart->txLength-uart->txSent);
+		if (n>0) uart->txSent+=n;
+		else if ((n<0) && (errno!=EAGAIN) && (errno!=EWOULDBLOCK)) return -1;
+		if (uart->txSent<uart->txLength) return 0;
+	}
+	if (modbusLinuxMicros()<uart->txEnd) return 0;
+	if ((ioctl(uart->fd,TIOCOUTQ,&queued)==0) && (queued>0)) return 0;
+	uart->txActive=0;
+	modbusCtxTransmitComplete(ctx);
+	return 0;
+}
+
+/* @brief: Sends as much of the pending responses of conn as the socket takes.
+*
+*/
+static int modbusTcpFlush(modbusTcpConnection *conn)
+{
+	while (conn->txStart<conn->txLength)
+	{
+		ssize_t n=send(conn->fd,conn->tx+conn->txStart,conn->txLength-conn->txStart,MSG_NOSIGNAL);
+		if (n>0) conn->txStart+=n;
+		else if ((n<0) && ((errno==EAGAIN) || (errno==EWOULDBLOCK))) break;
+		else return -1;
+	}
+	if (conn->txStart==conn->txLength) {
+		conn->txStart=0;
+		conn->txLength=0;
+	} else if (conn->txStart>=LINUX_TCP_BUFFER/2) { //make room for further responses
+		memmove(conn->tx,conn->tx+conn->txStart,conn->txLength-conn->txStart);
+		conn->txLength-=conn->txStart;
+		conn->txStart=0;
+	}
+	return 0;
+}
+
+/* @brief: Hands a single request (unit and PDU) to the handler of server and appends the
+*          response, if there is one, to the transmit buffer of conn.
+*
+*/
+static void modbusTcpRequest(modbusTcpServer *server, modbusTcpConnection *conn, const unsigned char *mbap, uint8_t length)
+{
+	modbusContext *ctx=&server->ctx;
+	unsigned char *out=conn->tx+conn->txLength;
+	uint16_t n=0;
+	modbusCtxReceiveFrame(ctx,mbap+MbapHeaderLength,length);
+	if (modbusCtxGetBusState(ctx)&(1<<ReceiveCompleted)) server->handler(ctx);
+	if (!ctx->uart.txPending) { //not answered
+		modbusCtxReset(ctx);
+		return;
+	}
+	ctx->uart.txPending=0;
+	do {
+		out[MbapHeaderLength+n++]=modbusCtxTransmitByte(ctx);
+	} while (!modbusCtxTransmitDone(ctx));
+	modbusCtxTransmitComplete(ctx);
+	out[0]=mbap[0]; //transaction identifier
+	out[1]=mbap[1];
+	out[2]=0; //protocol identifier
+	out[3]=0;
+	out[4]=(uint8_t)(n>>8);
+	out[5]=(uint8_t)n;
+	conn->txLength+=MbapHeaderLength+n;
+}
+
+#ifdef MODBUS_GATEWAY
+#define gatewayFree 0
+#define gatewayQueued 1
+#define gatewayBusy 2
+#define gatewayWaiting 3 //for the response to its leader
+
+/* @brief: returns the read function code whose data a write function code changes, 0 for others
+*
+*/
+static uint8_t modbusGatewayTable(uint8_t function)
+{
+	if ((function==fcForceSingleCoil) || (function==fcForceMultipleCoils)) return fcReadCoilStatus;
+	if ((function==fcPresetSingleRegister) || (function==fcPresetMultipleRegisters) || (function==fcMaskWriteRegister) || (function==fcReadWriteMultipleRegisters)) return fcReadHoldingRegisters;
+	return 0;
+}
+
+/* @brief: returns 1 for proper reads (function codes 1 to 4), which may be cached and shared
+*
+*/
+static uint8_t modbusGatewayIsRead(modbusGatewayRequest *request)
+{
+	uint8_t function=request->transaction.function;
+	if ((function<fcReadCoilStatus) || (function>fcReadInputRegisters) || (request->transaction.amount!=4) || !request->amount) return 0;
+	if (function<=fcReadInputStatus) return request->amount<=(MaxFrameIndex-4)*8;
+	return request->amount<=(MaxFrameIndex-4)/2;
+}
+
+/* @brief: returns 1 if pdu (length bytes after the function code) is a proper response to a
+*          read of amount data objects
+*
+*/
+static uint8_t modbusGatewayResponseValid(uint8_t function, uint16_t amount, const unsigned char *pdu, uint8_t length)
+{
+	uint16_t bytes=(function<=fcReadInputStatus) ? (amount+7)/8 : amount*2;
+	return (length>=1) && (pdu[0]==bytes) && (length==1+bytes);
+}
+
+/* @brief: Builds the response to a read of amount data objects at address from the response
+*          pdu to a read starting at from, which covers it. Returns the length of the response.
+*
+*/
+static uint8_t modbusGatewaySlice(uint8_t function, uint16_t from, const unsigned char *pdu, uint16_t address, uint16_t amount, unsigned char *out)
+{
+	uint16_t offset=address-from;
+	if (function<=fcReadInputStatus) {
+		out[0]=(amount+7)/8;
+		memset(out+1,0,out[0]);
+		listBitRangeCopy((volatile uint8_t *)pdu+1,offset,out+1,0,amount);
+	} else {
+		out[0]=amount*2;
+		memcpy(out+1,pdu+1+offset*2,out[0]);
+	}
+	return 1+out[0];
+}
+
+/* @brief: Appends the response to request to the transmit buffer of its connection.
+*          function has bit 7 set for exceptions.
+*
+*/
+static void modbusGatewayRespond(modbusGatewayRequest *request, uint8_t function, const unsigned char *pdu, uint8_t length)
+{
+	modbusTcpConnection *conn=&request->server->connections[request->connection];
+	unsigned char *out=conn->tx+conn->txLength;
+	if ((conn->fd<0) || !request->transaction.slave) return; //gone, or a broadcast
+	out[0]=request->tid[0];
+	out[1]=request->tid[1];
+	out[2]=0;
+	out[3]=0;
+	out[4]=0;
+	out[5]=2+length;
+	out[6]=request->transaction.slave;
+	out[7]=function;
+	memcpy(out+8,pdu,length);
+	conn->txLength+=MbapHeaderLength+2+length;
+}
+
+/* @brief: Frees request, which had been answered or dropped.
+*
+*/
+static void modbusGatewayRelease(modbusGatewayRequest *request)
+{
+	request->state=gatewayFree;
+	request->server->connections[request->connection].pending--;
+}
+
+/* @brief: Returns the time a response to request stays valid.
+*
+*/
+static uint32_t modbusGatewayTtl(modbusTcpServer *server, modbusGatewayRequest *request)
+{
+	for (uint8_t c=0; c<server->cacheRuleCount; c++)
+	{
+		const modbusGatewayCacheRule *rule=&server->cacheRules[c];
+		if (rule->unit && (rule->unit!=request->transaction.slave)) continue;
+		if (rule->function && (rule->function!=request->transaction.function)) continue;
+		if ((request->address<rule->address) || ((uint32_t)request->address+request->amount>(uint32_t)rule->address+rule->amount)) continue;
+		return rule->ttl;
+	}
+	return server->cacheTtl;
+}
+
+/* @brief: Returns a valid cache entry covering the read of request, 0 if there is none.
+*
+*/
+static modbusGatewayCacheEntry *modbusGatewayLookup(modbusTcpServer *server, modbusGatewayRequest *request)
+{
+	uint64_t now=modbusLinuxMicros();
+	for (uint8_t c=0; c<LINUX_GATEWAY_CACHE; c++)
+	{
+		modbusGatewayCacheEntry *entry=&server->cache[c];
+		if ((entry->function!=request->transaction.function) || (entry->unit!=request->transaction.slave) || (entry->expires<=now)) continue;
+		if ((request->address>=entry->address) && ((uint32_t)request->address+request->amount<=(uint32_t)entry->address+entry->amount)) return entry;
+	}
+	return 0;
+}
+
+/* @brief: Keeps the response to the read of request for ttl microseconds. Replaces the entry
+*          of the same range, an unused one or the one that expires first.
+*
+*/
+static void modbusGatewayStore(modbusTcpServer *server, modbusGatewayRequest *request, uint32_t ttl)
+{
+	modbusGatewayCacheEntry *entry=&server->cache[0];
+	for (uint8_t c=0; c<LINUX_GATEWAY_CACHE; c++)
+	{
+		modbusGatewayCacheEntry *e=&server->cache[c];
+		if ((e->function==request->transaction.function) && (e->unit==request->transaction.slave) && (e->address==request->address) && (e->amount==request->amount)) {
+			entry=e;
+			break;
+		}
+		if (e->expires<entry->expires) entry=e; //unused entries expire at 0
+	}
+	entry->unit=request->transaction.slave;
+	entry->function=request->transaction.function;
+	entry->address=request->address;
+	entry->amount=request->amount;
+	entry->length=request->transaction.amount;
+	entry->expires=modbusLinuxMicros()+ttl;
+	memcpy(entry->pdu,request->pdu,entry->length);
+}
+
+/* @brief: Drops the cached data and stops the sharing of reads touched by a write of amount
+*          data objects at address. unit 0 (broadcast) touches all units.
+*
+*/
+static void modbusGatewayInvalidate(modbusTcpServer *server, uint8_t unit, uint8_t function, uint16_t address, uint16_t amount)
+{
+	uint32_t last=(uint32_t)address+amount;
+	for (uint8_t c=0; c<LINUX_GATEWAY_CACHE; c++)
+	{
+		modbusGatewayCacheEntry *entry=&server->cache[c];
+		if ((entry->function!=function) || (unit && (entry->unit!=unit))) continue;
+		if ((entry->address<last) && (address<(uint32_t)entry->address+entry->amount)) entry->expires=0;
+	}
+	for (uint8_t n=0; n<LINUX_MAX_CONNECTIONS; n++)
+	{
+		for (uint8_t r=0; r<LINUX_GATEWAY_DEPTH; r++)
+		{
+			modbusGatewayRequest *request=&server->connections[n].requests[r];
+			if (((request->state!=gatewayQueued) && (request->state!=gatewayBusy)) || !request->shared) continue;
+			if ((request->transaction.function!=function) || (unit && (request->transaction.slave!=unit))) continue;
+			if ((request->address<last) && (address<(uint32_t)request->address+request->amount)) request->shared=0; //the data is about to change
+		}
+	}
+}
+
+/* @brief: Sets address and amount of a write request to the data objects it changes (amount 0
+*          for other requests) and invalidates them.
+*
+*/
+static void modbusGatewayWrite(modbusTcpServer *server, modbusGatewayRequest *request)
+{
+	uint8_t function=modbusGatewayTable(request->transaction.function);
+	if (!function || (request->transaction.amount<4)) {
+		request->amount=0;
+		return;
+	}
+	if ((request->transaction.function==fcForceSingleCoil) || (request->transaction.function==fcPresetSingleRegister) || (request->transaction.function==fcMaskWriteRegister)) request->amount=1;
+	if (request->transaction.function==fcReadWriteMultipleRegisters) { //the written range follows the read one
+		if (request->transaction.amount<8) {
+			request->amount=0;
+			return;
+		}
+		request->address=(request->pdu[4]<<8)|request->pdu[5];
+		request->amount=(request->pdu[6]<<8)|request->pdu[7];
+	}
+	if (!request->amount) return;
+	modbusGatewayInvalidate(server,request->transaction.slave,function,request->address,request->amount);
+}
+
+/* @brief: returns 1 if another request of conn to the unit of request is in state, or in any
+*          state but gatewayFree for state gatewayFree. The responses of a connection to a unit
+*          keep their order, a read must not be answered early and a request must not overtake
+*          a read waiting for its leader.
+*
+*/
+static uint8_t modbusGatewayAhead(modbusTcpConnection *conn, modbusGatewayRequest *request, uint8_t state)
+{
+	for (uint8_t r=0; r<LINUX_GATEWAY_DEPTH; r++)
+	{
+		modbusGatewayRequest *other=&conn->requests[r];
+		if ((other==request) || (other->state==gatewayFree) || (other->transaction.slave!=request->transaction.slave)) continue;
+		if ((state==gatewayFree) || (other->state==state)) return 1;
+	}
+	return 0;
+}
+
+/* @brief: returns 1 if request is the next one its connection sends to its unit: no request
+*          of the connection to that unit is queued before it or waits for a leader.
+*
+*/
+static uint8_t modbusGatewayIsNext(modbusTcpConnection *conn, modbusGatewayRequest *request)
+{
+	for (uint8_t r=0; r<LINUX_GATEWAY_DEPTH; r++)
+	{
+		modbusGatewayRequest *other=&conn->requests[r];
+		if ((other==request) || (other->transaction.slave!=request->transaction.slave)) continue;
+		if (other->state==gatewayWaiting) return 0;
+		if ((other->state==gatewayQueued) && ((int32_t)(other->sequence-request->sequence)<0)) return 0;
+	}
+	return 1;
+}
+
+/* @brief: Returns a shared read that covers the read of request and is either on the bus or
+*          the next one of its connection to the unit. A read queued behind the pipeline of
+*          another connection is not joined, the request would lose its own turn.
+*
+*/
+static modbusGatewayRequest *modbusGatewayLeader(modbusTcpServer *server, modbusGatewayRequest *request)
+{
+	for (uint8_t n=0; n<LINUX_MAX_CONNECTIONS; n++)
+	{
+		for (uint8_t r=0; r<LINUX_GATEWAY_DEPTH; r++)
+		{
+			modbusGatewayRequest *leader=&server->connections[n].requests[r];
+			if (((leader->state!=gatewayQueued) && (leader->state!=gatewayBusy)) || !leader->shared || (leader==request)) continue;
+			if ((leader->transaction.function!=request->transaction.function) || (leader->transaction.slave!=request->transaction.slave)) continue;
+			if ((request->address<leader->address) || ((uint32_t)request->address+request->amount>(uint32_t)leader->address+leader->amount)) continue;
+			if ((leader->state==gatewayBusy) || modbusGatewayIsNext(&server->connections[n],leader)) return leader;
+		}
+	}
+	return 0;
+}
+
+/* @brief: Answers the reads waiting for leader, or lets them queue on their own if leader has
+*          been dropped (status TransactionQueued).
+*
+*/
+static void modbusGatewayFollowers(modbusTcpServer *server, modbusGatewayRequest *leader, uint8_t status)
+{
+	modbusTransaction *t=&leader->transaction;
+	uint8_t valid=(status==TransactionOk) && modbusGatewayResponseValid(t->function,leader->amount,leader->pdu,t->amount);
+	for (uint8_t n=0; n<LINUX_MAX_CONNECTIONS; n++)
+	{
+		for (uint8_t r=0; r<LINUX_GATEWAY_DEPTH; r++)
+		{
+			modbusGatewayRequest *request=&server->connections[n].requests[r];
+			unsigned char pdu[MaxFrameIndex];
+			if ((request->state!=gatewayWaiting) || (request->leader!=leader)) continue;
+			if (status==TransactionQueued) {
+				request->state=gatewayQueued;
+				continue;
+			}
+			if (valid) modbusGatewayRespond(request,t->function,pdu,modbusGatewaySlice(t->function,leader->address,leader->pdu,request->address,request->amount,pdu));
+			else {
+				pdu[0]=(status==TransactionException) ? t->exceptionCode : ecGatewayTargetFailed;
+				modbusGatewayRespond(request,t->function|0x80,pdu,1);
+			}
+			modbusGatewayRelease(request);
+		}
+	}
+}
+
+/* @brief: Puts the next request on the bus unless there is one already. Connections take turns,
+*          within a connection the units do, requests of a connection to the same unit keep
+*          their order.
+*
+*/
+static void modbusGatewayNext(modbusTcpServer *server)
+{
+	if (server->current) return;
+	for (uint8_t n=0; n<LINUX_MAX_CONNECTIONS; n++)
+	{
+		uint8_t c=(server->nextClient+n)%LINUX_MAX_CONNECTIONS;
+		modbusTcpConnection *conn=&server->connections[c];
+		modbusGatewayRequest *next=0;
+		uint8_t nextDistance=0;
+		if (!conn->pending) continue;
+		for (uint8_t r=0; r<LINUX_GATEWAY_DEPTH; r++)
+		{
+			modbusGatewayRequest *request=&conn->requests[r];
+			uint8_t distance=request->transaction.slave-conn->lastUnit-1; //units after the last one served come first
+			if ((request->state!=gatewayQueued) || modbusGatewayAhead(conn,request,gatewayWaiting)) continue;
+			if (!next || (distance<nextDistance) || ((distance==nextDistance) && ((int32_t)(request->sequence-next->sequence)<0))) {
+				next=request;
+				nextDistance=distance;
+			}
+		}
+		if (!next) continue;
+		conn->lastUnit=next->transaction.slave;
+		server->nextClient=c+1;
+		server->current=next;
+		server->busySince=modbusLinuxMicros();
+		server->stats.requests++;
+		next->state=gatewayBusy;
+		modbusCtxMasterSubmit(server->bus,&next->transaction);
+		return;
+	}
+}
+
+/* @brief: Called by the master when the transaction of a request has finished. Answers the
+*          request and the ones waiting for it, updates the cache and starts the next request.
+*
+*/
+static void modbusGatewayDone(modbusTransaction *t)
+{
+	modbusGatewayRequest *request=(modbusGatewayRequest *)t;
+	modbusTcpServer *server=request->server;
+	server->stats.busy+=modbusLinuxMicros()-server->busySince;
+	server->current=0;
+	if (request->shared) {
+		uint32_t ttl=modbusGatewayTtl(server,request);
+		if (ttl && (t->status==TransactionOk) && modbusGatewayResponseValid(t->function,request->amount,request->pdu,t->amount)) modbusGatewayStore(server,request,ttl);
+	} else if (modbusGatewayTable(t->function) && request->amount) modbusGatewayInvalidate(server,t->slave,modbusGatewayTable(t->function),request->address,request->amount); //reads started meanwhile may have seen the old data
+	if (t->status==TransactionOk) {
+		modbusGatewayRespond(request,t->function,request->pdu,t->amount);
+	} else {
+		if (t->status!=TransactionException) server->stats.failures++;
+		request->pdu[0]=(t->status==TransactionException) ? t->exceptionCode : ecGatewayTargetFailed;
+		modbusGatewayRespond(request,t->function|0x80,request->pdu,1);
+	}
+	modbusGatewayFollowers(server,request,t->status);
+	modbusGatewayRelease(request);
+	modbusGatewayNext(server);
+}
+
+/* @brief: Queues a request of conn for the bus, or answers it from the cache, or lets it wait
+*          for an identical one. Returns 0 if conn has no room for it.
+*
+*/
+static uint8_t modbusGatewayQueue(modbusTcpServer *server, modbusTcpConnection *conn, const unsigned char *mbap, uint8_t length)
+{
+	modbusGatewayRequest *request=0;
+	modbusGatewayCacheEntry *entry;
+	for (uint8_t r=0; r<LINUX_GATEWAY_DEPTH; r++)
+	{
+		if (conn->requests[r].state==gatewayFree) {
+			request=&conn->requests[r];
+			break;
+		}
+	}
+	if (!request) return 0;
+	request->server=server;
+	request->connection=conn-server->connections;
+	request->state=gatewayQueued;
+	request->tid[0]=mbap[0];
+	request->tid[1]=mbap[1];
+	request->sequence=server->sequence++;
+	request->leader=0;
+	request->transaction.slave=mbap[MbapHeaderLength];
+	request->transaction.function=mbap[MbapHeaderLength+1];
+	request->transaction.amount=length-2;
+	request->transaction.data=request->pdu;
+	request->transaction.raw=1;
+	request->transaction.callback=modbusGatewayDone;
+	memcpy(request->pdu,mbap+MbapHeaderLength+2,length-2);
+	request->address=(request->pdu[0]<<8)|request->pdu[1];
+	request->amount=(request->pdu[2]<<8)|request->pdu[3];
+	conn->pending++;
+	request->shared=modbusGatewayIsRead(request) && request->transaction.slave;
+	if (!request->shared) modbusGatewayWrite(server,request);
+	else if (!modbusGatewayAhead(conn,request,gatewayFree))
+	{
+		if ((entry=modbusGatewayLookup(server,request))) {
+			unsigned char pdu[MaxFrameIndex];
+			modbusGatewayRespond(request,request->transaction.function,pdu,modbusGatewaySlice(entry->function,entry->address,entry->pdu,request->address,request->amount,pdu));
+			modbusGatewayRelease(request);
+			server->stats.hits++;
+			return 1;
+		}
+		if ((request->leader=modbusGatewayLeader(server,request))) {
+			request->state=gatewayWaiting;
+			server->stats.joined++;
+			return 1;
+		}
+	}
+	modbusGatewayNext(server);
+	return 1;
+}
+
+int modbusTcpGateway(modbusTcpServer *server, const char *address, uint16_t port, modbusContext *bus)
+{
+	server->bus=bus;
+	return modbusTcpListen(server,address,port,0);
+}
+
+void modbusTcpGatewayCache(modbusTcpServer *server, uint32_t ttl, const modbusGatewayCacheRule *rules, uint8_t count)
+{
+	server->cacheTtl=ttl;
+	server->cacheRules=rules;
+	server->cacheRuleCount=count;
+}
+#endif
+
+/* @brief: Handles all complete requests in the receive buffer of conn, as long as their
+*          responses are sure to fit into the transmit buffer. Returns 1 if it had to stop
+*          because of the transmit buffer, -1 on broken frames, 0 otherwise.
+*
+*/
+static int modbusTcpProcess(modbusTcpServer *server, modbusTcpConnection *conn)
+{
+	uint16_t pos=0;
+	int result=0;
+	while (conn->rxLength-pos>=MbapHeaderLength+2)
+	{
+		unsigned char *mbap=conn->rx+pos;
+		uint16_t length=(mbap[4]<<8)|mbap[5]; //unit and PDU
+		if ((length<2) || (length>MaxFrameIndex-1)) return -1;
+		if (conn->rxLength-pos<MbapHeaderLength+length) break;
+		if (LINUX_TCP_BUFFER-conn->txLength<(conn->pending+1)*(MbapHeaderLength+MaxFrameIndex+1)) { //wait until the responses have been sent
+			result=1;
+			break;
+		}
+		if (!mbap[2] && !mbap[3]) //protocol identifier 0 is Modbus
+		{
+			#ifdef MODBUS_GATEWAY
+			if (server->bus) {
+				if (!modbusGatewayQueue(server,conn,mbap,(uint8_t)length)) break; //goes on once a response has been sent
+			} else
+			#endif
+			modbusTcpRequest(server,conn,mbap,(uint8_t)length);
+		}
+		pos+=MbapHeaderLength+length;
+	}
+	if (pos) {
+		memmove(conn->rx,conn->rx+pos,conn->rxLength-pos);
+		conn->rxLength-=pos;
+	}
+	return result;
+}
+
+static void modbusTcpDisconnect(modbusTcpServer *server, modbusTcpConnection *conn)
+{
+	close(conn->fd);
+	conn->fd=-1;
+	#ifdef MODBUS_GATEWAY
+	for (uint8_t r=0; r<LINUX_GATEWAY_DEPTH; r++)
+	{
+		modbusGatewayRequest *request=&conn->requests[r];
+		if ((request->state!=gatewayQueued) && (request->state!=gatewayWaiting)) continue;
+		if (request->state==gatewayQueued) modbusGatewayFollowers(server,request,TransactionQueued); //the others queue on their own
+		modbusGatewayRelease(request);
+	}
+	if (server->bus) modbusGatewayNext(server); //requests may have waited behind the freed ones
+	#else
+	(void)server;
+	#endif
+}
+
+/* @brief: Reads from conn, handles the requests and sends the responses.
+*
+*/
+static void modbusTcpService(modbusTcpServer *server, modbusTcpConnection *conn, short revents)
+{
+	int blocked;
+	if ((revents&POLLIN) && (conn->rxLength<LINUX_TCP_BUFFER))
+	{
+		ssize_t n=recv(conn->fd,conn->rx+conn->rxLength,LINUX_TCP_BUFFER-conn->rxLength,0);
+		if (n>0) conn->rxLength+=n;
+		else if ((n==0) || ((errno!=EAGAIN) && (errno!=EWOULDBLOCK) && (errno!=EINTR))) {
+			modbusTcpDisconnect(server,conn);
+			return;
+		}
+	} else if (revents&(POLLERR|POLLHUP)) {
+		modbusTcpDisconnect(server,conn);
+		return;
+	}
+	do {
+		blocked=modbusTcpProcess(server,conn);
+		if ((blocked<0) || (modbusTcpFlush(conn)<0)) {
+			modbusTcpDisconnect(server,conn);
+			return;
+		}
+	} while (blocked && !conn->txLength); //go on once the responses have been sent
+}
+
+/* @brief: Accepts all pending connections of server.
+*
+*/
+static void modbusTcpAccept(modbusTcpServer *server)
+{
+	int fd;
+	while ((fd=accept4(server->fd,0,0,SOCK_NONBLOCK|SOCK_CLOEXEC))>=0)
+	{
+		int one=1;
+		uint8_t c;
+		for (c=0; c<LINUX_MAX_CONNECTIONS; c++)
+		{
+			if ((server->connections[c].fd<0) && !server->connections[c].pending) break; //the response to a closed connection may still be on its way
+		}
+		if (c==LINUX_MAX_CONNECTIONS) { //no room
+			close(fd);
+			continue;
+		}
+		setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+		server->connections[c].fd=fd;
+		server->connections[c].rxLength=0;
+		server->connections[c].txStart=0;
+		server->connections[c].txLength=0;
+	}
+}
+
+int modbusTcpListen(modbusTcpServer *server, const char *address, uint16_t port, void (*handler)(modbusContext *ctx))
+{
+	struct addrinfo hints = { .ai_flags = AI_PASSIVE|AI_NUMERICSERV, .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+	struct addrinfo *list, *ai;
+	struct sockaddr_storage bound;
+	socklen_t boundLength=sizeof(bound);
+	char service[8];
+	int fd=-1;
+	int one=1;
+	if (linuxServerCount>=LINUX_MAX_SERVERS) {
+		errno=ENOSPC;
+		return -1;
+	}
+	snprintf(service,sizeof(service),"%u",port);
+	if (getaddrinfo(address,service,&hints,&list)) {
+		errno=EADDRNOTAVAIL;
+		return -1;
+	}
+	for (ai=list; ai; ai=ai->ai_next)
+	{
+		fd=socket(ai->ai_family,ai->ai_socktype|SOCK_NONBLOCK|SOCK_CLOEXEC,ai->ai_protocol);
+		if (fd<0) continue;
+		setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&one,sizeof(one));
+		if ((bind(fd,ai->ai_addr,ai->ai_addrlen)==0) && (listen(fd,SOMAXCONN)==0)) break;
+		close(fd);
+		fd=-1;
+	}
+	freeaddrinfo(list);
+	if (fd<0) return -1;
+	getsockname(fd,(struct sockaddr *)&bound,&boundLength);
+	if (bound.ss_family==AF_INET6) server->port=ntohs(((struct sockaddr_in6 *)&bound)->sin6_port);
+	else server->port=ntohs(((struct sockaddr_in *)&bound)->sin_port);
+	server->fd=fd;
+	server->handler=handler;
+	for (uint8_t c=0; c<LINUX_MAX_CONNECTIONS; c++) server->connections[c].fd=-1;
+	server->ctx.framing=FramingTcp;
+	server->ctx.uart.fd=-1;
+	server->ctx.uart.peerFd=-1;
+	server->ctx.uart.direction=0;
+	modbusCtxInit(&server->ctx);
+	linuxServers[linuxServerCount++]=server;
+	return 0;
+}
+
+void modbusTcpClose(modbusTcpServer *server)
+{
+	for (uint8_t c=0; c<linuxServerCount; c++)
+	{
+		if (linuxServers[c]!=server) continue;
+		linuxServers[c]=linuxServers[--linuxServerCount];
+		for (uint8_t n=0; n<LINUX_MAX_CONNECTIONS; n++)
+		{
+			if (server->connections[n].fd>=0) modbusTcpDisconnect(server,&server->connections[n]);
+		}
+		close(server->fd);
+		server->fd=-1;
+		return;
+	}
+}
+
+int modbusLinuxPoll(int timeout)
+{
+	struct pollfd fds[LINUX_MAX_CONTEXTS+LINUX_MAX_SERVERS*(LINUX_MAX_CONNECTIONS+1)];
+	modbusTcpServer *servers[LINUX_MAX_SERVERS*(LINUX_MAX_CONNECTIONS+1)];
+	modbusTcpConnection *connections[LINUX_MAX_SERVERS*(LINUX_MAX_CONNECTIONS+1)]; //0 for listening sockets
+	struct timespec wait = { .tv_sec = timeout/1000, .tv_nsec = (timeout%1000)*1000000L };
+	uint8_t count=linuxContextCount;
+	nfds_t total=count;
+	uint8_t busy=0;
+	uint8_t forever=(timeout<0);
+	int result=0;
+	for (uint8_t c=0; c<count; c++)
+	{
+		modbusContext *ctx=linuxContexts[c];
+		fds[c].fd=ctx->uart.fd;
+		fds[c].events=POLLIN;
+		if (ctx->uart.txActive && (ctx->uart.txSent<ctx->uart.txLength)) fds[c].events|=POLLOUT;
+		fds[c].revents=0;
+		busy|=modbusLinuxBusy(ctx);
+	}
+	for (uint8_t c=0; c<linuxServerCount; c++)
+	{
+		modbusTcpServer *server=linuxServers[c];
+		servers[total-count]=server;
+		connections[total-count]=0;
+		fds[total].fd=server->fd;
+		fds[total].events=POLLIN;
+		fds[total++].revents=0;
+		for (uint8_t n=0; n<LINUX_MAX_CONNECTIONS; n++)
+		{
+			modbusTcpConnection *conn=&server->connections[n];
+			if (conn->fd<0) continue;
+			servers[total-count]=server;
+			connections[total-count]=conn;
+			fds[total].fd=conn->fd;
+			fds[total].events=0;
+			if (conn->rxLength<LINUX_TCP_BUFFER) fds[total].events|=POLLIN;
+			if (conn->txStart<conn->txLength) fds[total].events|=POLLOUT;
+			fds[total++].revents=0;
+		}
+	}
+	if (busy && ((timeout<0) || (timeout*1000>linuxTickTime))) { //wake up for the next tick
+		wait.tv_sec=0;
+		wait.tv_nsec=linuxTickTime*1000L;
+		forever=0;
+	}
+	if ((ppoll(fds,total,forever?0:&wait,0)<0) && (errno!=EINTR)) return -1;
+	modbusLinuxTick();
+	for (uint8_t c=0; c<count; c++)
+	{
+		modbusContext *ctx=linuxContexts[c];
+		if ((fds[c].revents&POLLIN) && (modbusLinuxReceive(ctx)<0)) result=-1;
+		if (modbusLinuxTransmit(ctx)<0) result=-1;
+	}
+	for (nfds_t c=count; c<total; c++)
+	{
+		modbusTcpConnection *conn=connections[c-count];
+		if (!conn) {
+			if (fds[c].revents) modbusTcpAccept(servers[c-count]);
+		} else if ((conn->fd>=0) && (fds[c].revents || (conn->txStart<conn->txLength) || (conn->rxLength>=MbapHeaderLength+2))) { //responses from the bus, requests waiting for room
+			modbusTcpService(servers[c-count],conn,fds[c].revents);
+		}
+	}
+	return result;
+}
@@ -0,0 +1,293 @@
+#ifndef yaMBSlinux_H
+#define yaMBSlinux_H
+/************************************************************************
+Title:    Yet another (small) Modbus (server) implementation for the avr.
+          Linux backend.
+Author:   Max Brueggemann
+Hardware: serial devices and pseudo terminals under Linux
+License:  BSD-3-Clause
+
+LICENSE:
+
+Copyright 2017 Max Brueggemann, www.maxbrueggemann.de
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+THE POSSIBILITY OF SUCH DAMAGE.
+
+************************************************************************/
+#include <stddef.h>
+#include "yaMBSiavr.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  @code #include <yaMBSlinux.h> @endcode
+ *
+ *  @brief   Runs yaMBSiavr.c under Linux. Build both files with -DMODBUS_HAL=HAL_LINUX.
+ *           The UART is replaced by a serial device or a pseudo terminal in raw mode (8N1,
+ *           BAUD_SPD), the timer ISR by the monotonic clock. Everything happens in
+ *           modbusLinuxPoll, which replaces the ISRs and the timer: call it in a loop and
+ *           use the instance API in between, e.g.
+ *
+ *           static modbusContext bus;
+ *           modbusCtxSetAddress(&bus,1);
+ *           modbusLinuxOpen(&bus,"/dev/ttyUSB0");
+ *           while (modbusLinuxPoll(10)>=0) {
+ *               if (modbusCtxGetBusState(&bus) & (1<<ReceiveCompleted)) ...
+ *           }
+ *
+ *           Instances have to be zero-initialized before use (static or = {0}).
+ *           For RS485 adapters either let the kernel switch the transceiver (TIOCSRS485)
+ *           or set ctx->uart.direction after opening.
+ *           Single threaded: call all functions of the library from the thread running
+ *           modbusLinuxPoll.
+ */
+
+/**
+ * @brief    Maximum number of instances that can be open at the same time.
+ */
+#ifndef LINUX_MAX_CONTEXTS
+#define LINUX_MAX_CONTEXTS 8
+#endif
+
+/**
+ * @brief    Opens device (e.g. /dev/ttyUSB0 or the slave side of a pseudo terminal) for ctx
+ *           and initializes ctx (modbusCtxInit). Returns 0 on success, -1 otherwise (errno).
+ */
+extern int modbusLinuxOpen(modbusContext *ctx, const char *device);
+
+/**
+ * @brief    Creates a pseudo terminal pair, binds ctx to its master side and initializes ctx.
+ *           The name of the slave side, which is where the other end of the "bus" connects,
+ *           is copied to peer. Returns 0 on success, -1 otherwise (errno).
+ */
+extern int modbusLinuxOpenPty(modbusContext *ctx, char *peer, size_t size);
+
+/**
+ * @brief    Closes the device of ctx.
+ */
+extern void modbusLinuxClose(modbusContext *ctx);
+
+/**
+ * @brief    Serves all open instances and Modbus TCP servers: waits up to timeout
+ *           milliseconds (-1: forever) for data, advances the ticks to the current time,
+ *           feeds received bytes and requests to the core and sends pending frames.
+ *           While a bus is busy it never waits longer than a tick.
+ *           Returns -1 on errors, 0 otherwise.
+ */
+extern int modbusLinuxPoll(int timeout);
+
+/**
+ * @brief    Returns the current time in microseconds (CLOCK_MONOTONIC).
+ */
+extern uint64_t modbusLinuxMicros(void);
+
+/**
+ *  @brief   Modbus TCP server. The requests of all connections are handed to a single
+ *           instance with FramingTcp (server->ctx), one after another, by calling handler.
+ *           The handler works exactly like the receive part of an RTU main loop and
+ *           answers with the usual modbusCtxExchangeRegisters, modbusCtxSendException etc.,
+ *           so the same function can serve an RTU and a TCP instance:
+ *
+ *           static modbusTcpServer server;
+ *           modbusTcpListen(&server,0,502,modbusGet);
+ *           while (modbusLinuxPoll(-1)>=0);
+ *
+ *           A client may send further requests before the first response has arrived
+ *           (pipelining), their transaction identifiers are copied to the responses. The
+ *           unit identifier is found in buffer[0], requests are not filtered by it.
+ *           A request the handler does not answer is dropped.
+ */
+
+/**
+ * @brief    Maximum number of servers and of connections per server.
+ */
+#ifndef LINUX_MAX_SERVERS
+#define LINUX_MAX_SERVERS 2
+#endif
+#ifndef LINUX_MAX_CONNECTIONS
+#define LINUX_MAX_CONNECTIONS 32
+#endif
+
+/**
+ * @brief    Receive and transmit buffer of a connection. Reading from a connection pauses
+ *           while its responses do not fit into the transmit buffer.
+ */
+#ifndef LINUX_TCP_BUFFER
+#define LINUX_TCP_BUFFER 4096
+#endif
+
+#define MbapHeaderLength 6 //transaction, protocol and length, followed by unit and PDU
+
+typedef struct modbusTcpServer modbusTcpServer;
+
+#ifdef MODBUS_GATEWAY
+/**
+ * @brief    Requests a gateway connection may have queued or on the bus at the same time.
+ *           Further requests of the connection wait in its receive buffer.
+ */
+#ifndef LINUX_GATEWAY_DEPTH
+#define LINUX_GATEWAY_DEPTH 8
+#endif
+
+#if LINUX_TCP_BUFFER < (LINUX_GATEWAY_DEPTH+1)*(MbapHeaderLength+MaxFrameIndex+1)
+#error "LINUX_TCP_BUFFER is too small for LINUX_GATEWAY_DEPTH responses"
+#endif
+
+/**
+ * @brief    Responses to reads (function codes 1 to 4) a gateway keeps, see modbusTcpGatewayCache.
+ */
+#ifndef LINUX_GATEWAY_CACHE
+#define LINUX_GATEWAY_CACHE 32
+#endif
+
+typedef struct modbusGatewayRequest {
+	modbusTransaction transaction; //raw, see MODBUS_GATEWAY
+	modbusTcpServer *server;
+	uint8_t connection;
+	uint8_t state; //internal: free, queued, on the bus or waiting for the response to leader
+	uint8_t shared; //reads only: other reads of the range may wait for this one
+	unsigned char tid[2]; //transaction identifier of the request
+	uint16_t address; //reads only: requested range
+	uint16_t amount;
+	uint32_t sequence; //order of arrival
+	struct modbusGatewayRequest *leader;
+	unsigned char pdu[MaxFrameIndex];
+} modbusGatewayRequest;
+
+/**
+ * @brief    Time a response to a read of the range stays valid, see modbusTcpGatewayCache.
+ *           unit 0 and function 0 match every unit and every read function. A request matches
+ *           if its range lies within address and address+amount-1.
+ */
+typedef struct {
+	uint8_t unit;
+	uint8_t function;
+	uint16_t address;
+	uint16_t amount;
+	uint32_t ttl; //microseconds, 0: never cached
+} modbusGatewayCacheRule;
+
+typedef struct {
+	uint8_t unit;
+	uint8_t function; //0 if unused
+	uint16_t address;
+	uint16_t amount;
+	uint8_t length;
+	uint64_t expires;
+	unsigned char pdu[MaxFrameIndex]; //byte count and data
+} modbusGatewayCacheEntry;
+
+/**
+ * @brief    Statistics of a gateway. Bus utilisation is busy divided by the time elapsed.
+ */
+typedef struct {
+	uint32_t requests; //sent to the bus
+	uint32_t failures; //answered with ecGatewayTargetFailed
+	uint32_t hits; //reads answered from the cache
+	uint32_t joined; //reads answered with the response to an identical one
+	uint64_t busy; //microseconds spent on transactions, from sending a request to the end of its response
+} modbusGatewayStats;
+#endif
+
+typedef struct {
+	int fd; //-1 if unused
+	uint8_t pending; //requests waiting for their response
+	uint16_t rxLength;
+	uint16_t txStart;
+	uint16_t txLength;
+	unsigned char rx[LINUX_TCP_BUFFER];
+	unsigned char tx[LINUX_TCP_BUFFER];
+#ifdef MODBUS_GATEWAY
+	uint8_t lastUnit; //unit served last
+	modbusGatewayRequest requests[LINUX_GATEWAY_DEPTH];
+#endif
+} modbusTcpConnection;
+
+struct modbusTcpServer {
+	modbusContext ctx;
+	int fd;
+	uint16_t port; //the port actually bound, useful after listening on port 0
+	void (*handler)(modbusContext *ctx);
+	modbusTcpConnection connections[LINUX_MAX_CONNECTIONS];
+#ifdef MODBUS_GATEWAY
+	modbusContext *bus; //RTU master the requests are forwarded to, 0 for a plain server
+	modbusGatewayRequest *current; //on the bus
+	uint8_t nextClient;
+	uint32_t sequence;
+	uint64_t busySince;
+	modbusGatewayStats stats;
+	uint32_t cacheTtl;
+	const modbusGatewayCacheRule *cacheRules;
+	uint8_t cacheRuleCount;
+	modbusGatewayCacheEntry cache[LINUX_GATEWAY_CACHE];
+#endif
+};
+
+/**
+ * @brief    Listens on address (0: all addresses) and port, served by modbusLinuxPoll.
+ *           Returns 0 on success, -1 otherwise (errno).
+ */
+extern int modbusTcpListen(modbusTcpServer *server, const char *address, uint16_t port, void (*handler)(modbusContext *ctx));
+
+/**
+ * @brief    Closes the listening socket and all connections of server.
+ */
+extern void modbusTcpClose(modbusTcpServer *server);
+
+#ifdef MODBUS_GATEWAY
+/**
+ *  @brief   Modbus TCP to RTU gateway. Requires MODBUS_MASTER and MODBUS_GATEWAY, bus is an
+ *           instance opened with modbusLinuxOpen. Every request is forwarded unchanged to the
+ *           slave given by its unit identifier, one at a time. Each connection queues up to
+ *           LINUX_GATEWAY_DEPTH requests. The next request is taken from the connections
+ *           round robin, and within a connection from the units round robin, so a client
+ *           with many requests or a slow slave cannot hold up the others. Requests of a
+ *           client to the same unit keep their order. The next request is sent as soon as
+ *           the previous transaction has finished, i.e. after the 3.5 characters of silence
+ *           that end a response.
+ *           Slaves that do not respond (see MASTER_SLAVE_SLOTS) are answered with
+ *           ecGatewayTargetFailed. Broadcasts (unit 0) are sent but not answered.
+ */
+extern int modbusTcpGateway(modbusTcpServer *server, const char *address, uint16_t port, modbusContext *bus);
+
+/**
+ * @brief    Lets the gateway answer reads from the responses to earlier ones. A response is
+ *           kept for the ttl of the first rule matching the request, ttl (microseconds) if
+ *           there is none. Any read that lies within a kept response is answered from it.
+ *           Writes (function codes 5, 6, 15 and 16) drop what they touch, when they are
+ *           received and again when they have been carried out. Independent of the cache, a
+ *           read that lies within a read already queued or on the bus waits for its response
+ *           instead of taking the bus once more. rules may be 0, it is not copied.
+ */
+extern void modbusTcpGatewayCache(modbusTcpServer *server, uint32_t ttl, const modbusGatewayCacheRule *rules, uint8_t count);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,389 @@
+/************************************************************************
+Title:    Yet another (small) Modbus (server) implementation for the avr.
+          Simulated bus backend.
+Author:   Max Brueggemann
+Hardware: none, a simulated RS485 bus in virtual time
+License:  BSD-3-Clause
+
+LICENSE:
+
+Copyright 2017 Max Brueggemann, www.maxbrueggemann.de
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+THE POSSIBILITY OF SUCH DAMAGE.
+
+************************************************************************/
+#include <string.h>
+#include "yaMBSsim.h"
+
+#if MODBUS_HAL != HAL_SIM
+#error "build yaMBSsim.c and yaMBSiavr.c with -DMODBUS_HAL=HAL_SIM"
+#endif
+
+#define simTickShift 7000 //ns the ticks of an instance are shifted against those of the one before
+
+void modbusHalInit(modbusContext *ctx)
+{
+	ctx->uart.txRequested=0;
+	ctx->uart.sending=0;
+}
+
+void modbusHalStartTransmit(modbusContext *ctx)
+{
+	ctx->uart.txRequested=1;
+}
+
+void modbusHalTransceiver(modbusContext *ctx, uint8_t transmit)
+{
+	ctx->uart.driver=transmit;
+}
+
+#ifdef MODBUS_EVENTS
+void modbusHalIdle(void)
+{
+}
+#endif
+
+#if TIMING_MODE == TIMING_ONESHOT
+void modbusHalTimerStart(modbusContext *ctx)
+{
+	ctx->uart.timerBase=ctx->uart.bus->now;
+}
+
+void modbusHalTimerArm(modbusContext *ctx, uint16_t ticks)
+{
+	ctx->uart.timerDeadline=ticks ? ctx->uart.timerBase+(uint64_t)ticks*SIM_TICK : 0;
+}
+#endif
+
+void modbusSimInit(modbusSimBus *bus, uint32_t baud)
+{
+	memset(bus,0,sizeof(*bus));
+	bus->baud=baud;
+	bus->charTime=(10*1000000000ULL+baud/2)/baud;
+	bus->lastSource=SIM_INJECTED;
+	bus->stats.silenceMin=UINT64_MAX;
+}
+
+int modbusSimAttach(modbusSimBus *bus, modbusContext *ctx, void (*poll)(modbusContext *ctx), uint32_t pollPeriod)
+{
+	if (bus->nodeCount>=SIM_MAX_NODES) return -1;
+	ctx->uart.bus=bus;
+	ctx->uart.poll=poll;
+	ctx->uart.pollPeriod=pollPeriod;
+	ctx->uart.nextPoll=bus->now;
+	ctx->uart.nextTick=bus->now+SIM_TICK-((uint32_t)bus->nodeCount*simTickShift)%SIM_TICK;
+	ctx->uart.node=bus->nodeCount;
+	bus->nodes[bus->nodeCount++]=ctx;
+	modbusCtxInit(ctx);
+	return 0;
+}
+
+uint64_t modbusSimChars(modbusSimBus *bus, float characters)
+{
+	return (uint64_t)(characters*bus->charTime);
+}
+
+/* @brief: xorshift, the pseudo random numbers of the noise
+*
+*/
+static uint32_t modbusSimRandom(modbusSimBus *bus)
+{
+	uint32_t x=bus->noiseState;
+	x^=x<<13;
+	x^=x>>17;
+	x^=x<<5;
+	return bus->noiseState=x;
+}
+
+/* @brief: Time of the next noise character, on average 1/rate seconds from now: every
+*          character time is hit with the probability rate*charTime, so that the gaps are
+*          distributed exponentially like those of independent disturbances.
+*
+*/
+static void modbusSimNextNoise(modbusSimBus *bus)
+{
+	double p=(double)bus->noiseRate*bus->charTime/1e9;
+	uint32_t threshold=(p<1) ? (uint32_t)(p*UINT32_MAX) : UINT32_MAX;
+	bus->nextNoise=bus->now+1+modbusSimRandom(bus)%bus->charTime;
+	while (modbusSimRandom(bus)>threshold) bus->nextNoise+=bus->charTime;
+}
+
+void modbusSimNoise(modbusSimBus *bus, uint32_t rate, uint32_t seed)
+{
+	bus->noiseRate=rate;
+	bus->noiseState=seed ? seed : 1;
+	if (rate) modbusSimNextNoise(bus);
+}
+
+uint64_t modbusSimWrite(modbusSimBus *bus, uint64_t at, const uint8_t *data, uint16_t length, uint64_t gap)
+{
+	if (at<bus->now) at=bus->now;
+	if (bus->scheduledTail+length>SIM_MAX_SCHEDULED)
+	{
+		memmove(bus->scheduled,bus->scheduled+bus->scheduledHead,(bus->scheduledTail-bus->scheduledHead)*sizeof(modbusSimChar));
+		bus->scheduledTail-=bus->scheduledHead;
+		bus->scheduledHead=0;
+		if (bus->scheduledTail+length>SIM_MAX_SCHEDULED) return 0;
+	}
+	for (uint16_t c=0; c<length; c++)
+	{
+		uint16_t n=bus->scheduledTail++;
+		while ((n>bus->scheduledHead) && (bus->scheduled[n-1].start>at)) { //keep them sorted
+			bus->scheduled[n]=bus->scheduled[n-1];
+			n--;
+		}
+		bus->scheduled[n].start=at;
+		bus->scheduled[n].end=at+bus->charTime;
+		bus->scheduled[n].data=data[c];
+		bus->scheduled[n].received=data[c];
+		bus->scheduled[n].collided=0;
+		bus->scheduled[n].source=SIM_INJECTED;
+		at+=bus->charTime+gap;
+	}
+	return at-gap;
+}
+
+/* @brief: c is hit by other. Characters sent at the same time add up bit by bit (a dominant
+*          0), if their start bits do not line up the receiver gets garbage.
+*
+*/
+static void modbusSimCollide(modbusSimChar *c, const modbusSimChar *other)
+{
+	c->collided=1;
+	if (c->start==other->start) c->received&=other->data;
+	else c->received^=(uint8_t)~other->data;
+}
+
+/* @brief: Puts c on the bus. Characters that overlap break each other.
+*
+*/
+static void modbusSimStart(modbusSimBus *bus, modbusSimChar *c)
+{
+	if (bus->activeCount==SIM_MAX_ACTIVE) {
+		bus->stats.lost++;
+		return;
+	}
+	for (uint8_t n=0; n<bus->activeCount; n++)
+	{
+		modbusSimChar *other=&bus->active[n];
+		if (other->end<=c->start) continue; //ends right now
+		modbusSimCollide(other,c);
+		modbusSimCollide(c,other);
+	}
+	bus->active[bus->activeCount++]=*c;
+}
+
+/* @brief: Puts the next character of ctx on the bus.
+*
+*/
+static void modbusSimSendNext(modbusSimBus *bus, modbusContext *ctx)
+{
+	modbusSimChar c;
+	c.start=bus->now;
+	c.end=bus->now+bus->charTime;
+	c.data=modbusCtxTransmitByte(ctx);
+	c.received=c.data;
+	c.collided=0;
+	c.source=ctx->uart.node;
+	ctx->uart.sending=1;
+	modbusSimStart(bus,&c);
+}
+
+/* @brief: c has ended: hands it to the receivers and lets its instance go on with the next one.
+*
+*/
+static void modbusSimDeliver(modbusSimBus *bus, modbusSimChar *c)
+{
+	bus->stats.characters++;
+	if (c->collided) bus->stats.collisions++;
+	for (uint8_t n=0; n<bus->nodeCount; n++)
+	{
+		if (!bus->nodes[n]->uart.driver) modbusCtxReceiveByte(bus->nodes[n],c->received);
+	}
+	if (c->source!=SIM_NOISE) {
+		bus->lastEnd=c->end;
+		bus->lastSource=c->source;
+	}
+	if (bus->monitor) bus->monitor(bus,c);
+	if (c->source>=0)
+	{
+		modbusContext *ctx=bus->nodes[c->source];
+		if (!modbusCtxTransmitDone(ctx)) modbusSimSendNext(bus,ctx);
+		else {
+			ctx->uart.sending=0;
+			modbusCtxTransmitComplete(ctx);
+		}
+	}
+}
+
+/* @brief: Returns the time of the next event.
+*
+*/
+static uint64_t modbusSimNext(modbusSimBus *bus)
+{
+	uint64_t next=UINT64_MAX;
+	for (uint8_t n=0; n<bus->activeCount; n++)
+	{
+		if (bus->active[n].end<next) next=bus->active[n].end;
+	}
+	if ((bus->scheduledHead<bus->scheduledTail) && (bus->scheduled[bus->scheduledHead].start<next)) next=bus->scheduled[bus->scheduledHead].start;
+	if (bus->noiseRate && (bus->nextNoise<next)) next=bus->nextNoise;
+	for (uint8_t n=0; n<bus->nodeCount; n++)
+	{
+		modbusUart *uart=&bus->nodes[n]->uart;
+		if (uart->txRequested) return bus->now;
+#if TIMING_MODE == TIMING_ONESHOT
+		if (uart->timerDeadline && (uart->timerDeadline<next)) next=uart->timerDeadline;
+#else
+		if (uart->nextTick<next) next=uart->nextTick;
+#endif
+		if (uart->poll && uart->pollPeriod && (uart->nextPoll<next)) next=uart->nextPoll;
+	}
+	return next;
+}
+
+/* @brief: Handles everything that happens at bus->now: characters end, ticks, characters
+*          start, main loops run.
+*
+*/
+static void modbusSimStep(modbusSimBus *bus)
+{
+	for (uint8_t n=0; n<bus->activeCount; )
+	{
+		modbusSimChar c=bus->active[n];
+		if (c.end!=bus->now) {
+			n++;
+			continue;
+		}
+		bus->activeCount--;
+		memmove(&bus->active[n],&bus->active[n+1],(bus->activeCount-n)*sizeof(modbusSimChar));
+		modbusSimDeliver(bus,&c);
+	}
+	for (uint8_t n=0; n<bus->nodeCount; n++)
+	{
+		modbusUart *uart=&bus->nodes[n]->uart;
+#if TIMING_MODE == TIMING_ONESHOT
+		if (uart->timerDeadline!=bus->now) continue;
+		uart->timerDeadline=0;
+		bus->stats.timerInterrupts++;
+		modbusCtxTimerExpired(bus->nodes[n]);
+#else
+		if (uart->nextTick!=bus->now) continue;
+		uart->nextTick+=SIM_TICK;
+		bus->stats.timerInterrupts++;
+		modbusCtxTickTimer(bus->nodes[n]);
+#endif
+	}
+	while ((bus->scheduledHead<bus->scheduledTail) && (bus->scheduled[bus->scheduledHead].start==bus->now))
+	{
+		modbusSimStart(bus,&bus->scheduled[bus->scheduledHead++]);
+	}
+	if (bus->noiseRate && (bus->nextNoise==bus->now))
+	{
+		modbusSimChar c;
+		c.start=bus->now;
+		c.end=bus->now+bus->charTime;
+		c.data=(uint8_t)modbusSimRandom(bus);
+		c.received=c.data;
+		c.collided=0;
+		c.source=SIM_NOISE;
+		modbusSimStart(bus,&c);
+		modbusSimNextNoise(bus);
+	}
+	for (uint8_t n=0; n<bus->nodeCount; n++)
+	{
+		modbusContext *ctx=bus->nodes[n];
+		if (!ctx->uart.txRequested) continue;
+		ctx->uart.txRequested=0;
+		if (bus->lastEnd && (bus->lastSource!=n)) {
+			uint64_t silence=bus->now-bus->lastEnd;
+			for (uint8_t a=0; a<bus->activeCount; a++)
+			{
+				if (bus->active[a].source!=SIM_NOISE) silence=0; //starts within a frame
+			}
+			if (silence<bus->stats.silenceMin) bus->stats.silenceMin=silence;
+			if (silence>bus->stats.silenceMax) bus->stats.silenceMax=silence;
+		}
+		bus->stats.frames++;
+		modbusSimSendNext(bus,ctx);
+	}
+	for (uint8_t n=0; n<bus->nodeCount; n++)
+	{
+		modbusUart *uart=&bus->nodes[n]->uart;
+		if (!uart->poll || (uart->pollPeriod && (uart->nextPoll!=bus->now))) continue;
+		if (uart->pollPeriod) uart->nextPoll+=uart->pollPeriod;
+		uart->poll(bus->nodes[n]);
+	}
+}
+
+void modbusSimRun(modbusSimBus *bus, uint64_t until)
+{
+	uint64_t next;
+	while ((next=modbusSimNext(bus))<=until)
+	{
+		bus->now=next;
+		modbusSimStep(bus);
+	}
+	if (until>bus->now) bus->now=until;
+}
+
+/* @brief: returns 1 if nothing is on the bus, scheduled or about to be sent by an instance
+*
+*/
+static uint8_t modbusSimQuiet(modbusSimBus *bus)
+{
+	if (bus->scheduledHead<bus->scheduledTail) return 0;
+	for (uint8_t n=0; n<bus->activeCount; n++)
+	{
+		if (bus->active[n].source!=SIM_NOISE) return 0;
+	}
+	for (uint8_t n=0; n<bus->nodeCount; n++)
+	{
+		if (bus->nodes[n]->uart.txRequested || bus->nodes[n]->uart.sending) return 0;
+	}
+	return 1;
+}
+
+uint8_t modbusSimRunUntilIdle(modbusSimBus *bus, uint64_t silence, uint64_t limit)
+{
+	while (1)
+	{
+		uint64_t next=modbusSimNext(bus);
+		uint64_t idle=bus->lastEnd+silence;
+		if (idle<bus->now) idle=bus->now;
+		if (modbusSimQuiet(bus) && (idle<=next)) { //nothing happens before the bus has been silent long enough
+			if (idle>limit) break;
+			bus->now=idle;
+			return 1;
+		}
+		if (next>limit) break;
+		bus->now=next;
+		modbusSimStep(bus);
+	}
+	bus->now=limit;
+	return 0;
+}
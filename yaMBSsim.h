@@ -0,0 +1,187 @@
+#ifndef yaMBSsim_H
+#define yaMBSsim_H
+/************************************************************************
+Title:    Yet another (small) Modbus (server) implementation for the avr.
+          Simulated bus backend.
+Author:   Max Brueggemann
+Hardware: none, a simulated RS485 bus in virtual time
+License:  BSD-3-Clause
+
+LICENSE:
+
+Copyright 2017 Max Brueggemann, www.maxbrueggemann.de
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software without
+specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF
+THE POSSIBILITY OF SUCH DAMAGE.
+
+************************************************************************/
+#include "yaMBSiavr.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ *  @code #include <yaMBSsim.h> @endcode
+ *
+ *  @brief   Runs instances of yaMBSiavr.c on a simulated RS485 bus. Build both files with
+ *           -DMODBUS_HAL=HAL_SIM. Time is virtual (nanoseconds) and advances from event to
+ *           event, so every run gives the same result. Every character (8N1) occupies the
+ *           bus for exactly 10 bit times and reaches the receivers at its end, like the
+ *           receive interrupt of a UART. Each instance gets modbusCtxTickTimer every 100us
+ *           (with TIMING_ONESHOT modbusCtxTimerExpired when its timer expires) and its main
+ *           loop (poll) as often as configured. Frames of a test program, gaps
+ *           and noise are injected with modbusSimWrite and modbusSimNoise. Characters that
+ *           overlap collide: if they start together both arrive as the bitwise AND of the
+ *           two, otherwise as garbage (an arbitrary but reproducible model of a broken
+ *           character). An instance transmitting does not receive (DE and /RE tied
+ *           together). e.g.
+ *
+ *           static modbusSimBus bus;
+ *           static modbusContext slave;
+ *           modbusSimInit(&bus,BAUD_SPD);
+ *           modbusCtxSetAddress(&slave,1);
+ *           modbusSimAttach(&bus,&slave,modbusGet,0);
+ *           modbusSimWrite(&bus,bus.now,request,8,0);
+ *           modbusSimRunUntilIdle(&bus,modbusSimChars(&bus,3.5),1000000000);
+ *
+ *           As MODBUS_MASTER applies to all instances of a build, the instances of a build
+ *           are either slaves, tested by frames the program injects, or a master, answered
+ *           by the program. modbusCtxWaitForEvent must not be used.
+ */
+
+/**
+ * @brief    Maximum number of instances on a bus, of injected characters waiting to be sent
+ *           and of characters on the bus at the same time.
+ */
+#ifndef SIM_MAX_NODES
+#define SIM_MAX_NODES 16
+#endif
+#ifndef SIM_MAX_SCHEDULED
+#define SIM_MAX_SCHEDULED 1024
+#endif
+#define SIM_MAX_ACTIVE (SIM_MAX_NODES+4)
+
+#define SIM_TICK (timerISROccurenceTime*1000ULL) //ns between two calls of modbusCtxTickTimer
+#define SIM_INJECTED -1 //source of characters written by modbusSimWrite
+#define SIM_NOISE -2 //source of characters made up by modbusSimNoise
+
+/**
+ * @brief    A character on the bus.
+ */
+typedef struct {
+	uint64_t start; //ns
+	uint64_t end;
+	uint8_t data; //as sent
+	uint8_t received; //as the receivers get it, differs from data after a collision
+	uint8_t collided;
+	int8_t source; //index of the instance, SIM_INJECTED or SIM_NOISE
+} modbusSimChar;
+
+/**
+ * @brief    Statistics of a bus. The silence before a frame of an instance is the time from
+ *           the end of the last character of another source to the start of the frame, it
+ *           should be 3.5 characters at least. Noise does not count, neither here nor for
+ *           modbusSimRunUntilIdle.
+ */
+typedef struct {
+	uint32_t characters; //on the bus, of all sources
+	uint32_t collisions; //characters that arrived broken
+	uint32_t frames; //sent by instances
+	uint32_t lost; //characters that did not fit into the list of characters on the bus
+	uint32_t timerInterrupts; //calls of modbusCtxTickTimer or modbusCtxTimerExpired, of all instances
+	uint64_t silenceMin; //ns, of frames of instances
+	uint64_t silenceMax;
+} modbusSimStats;
+
+typedef struct modbusSimBus {
+	uint32_t baud;
+	uint64_t charTime; //ns per character
+	uint64_t now; //ns
+	modbusContext *nodes[SIM_MAX_NODES];
+	uint8_t nodeCount;
+	modbusSimChar scheduled[SIM_MAX_SCHEDULED]; //injected, sorted by start
+	uint16_t scheduledHead;
+	uint16_t scheduledTail;
+	modbusSimChar active[SIM_MAX_ACTIVE]; //on the bus right now
+	uint8_t activeCount;
+	uint32_t noiseRate; //characters per second
+	uint32_t noiseState;
+	uint64_t nextNoise;
+	uint64_t lastEnd; //end of the last character on the bus that was not noise
+	int8_t lastSource;
+	void (*monitor)(struct modbusSimBus *bus, const modbusSimChar *c); //sees every character at its end, may be 0
+	void *user; //free for the program
+	modbusSimStats stats;
+} modbusSimBus;
+
+/**
+ * @brief    Sets up an empty bus running at baud. The instances always use the timing of
+ *           BAUD_SPD, a different baud rate shows how they cope with a mismatch.
+ */
+extern void modbusSimInit(modbusSimBus *bus, uint32_t baud);
+
+/**
+ * @brief    Puts ctx on bus and initializes it (modbusCtxInit). poll is the main loop of the
+ *           instance and is called every pollPeriod ns, after every event for 0. Its ticks
+ *           are shifted a little against those of the other instances. ctx has to be
+ *           zero-initialized before. Returns 0 on success, -1 if the bus is full.
+ */
+extern int modbusSimAttach(modbusSimBus *bus, modbusContext *ctx, void (*poll)(modbusContext *ctx), uint32_t pollPeriod);
+
+/**
+ * @brief    Sends length bytes from data, the first starting at time at (ns, not before
+ *           bus->now), with gap ns of silence between two characters. Nothing is checked,
+ *           overlapping characters collide. Returns the end of the last character, 0 if there
+ *           is no room for the characters.
+ */
+extern uint64_t modbusSimWrite(modbusSimBus *bus, uint64_t at, const uint8_t *data, uint16_t length, uint64_t gap);
+
+/**
+ * @brief    Makes up random characters at random times, rate per second on average (0: none),
+ *           from the pseudo random sequence given by seed.
+ */
+extern void modbusSimNoise(modbusSimBus *bus, uint32_t rate, uint32_t seed);
+
+/**
+ * @brief    Runs the bus until time until (ns).
+ */
+extern void modbusSimRun(modbusSimBus *bus, uint64_t until);
+
+/**
+ * @brief    Runs the bus until nothing has been sent for silence ns, nothing is on its way and
+ *           no instance is about to send, but not beyond limit. Returns 1 if the bus is idle.
+ */
+extern uint8_t modbusSimRunUntilIdle(modbusSimBus *bus, uint64_t silence, uint64_t limit);
+
+/**
+ * @brief    Returns the duration of characters characters in ns.
+ */
+extern uint64_t modbusSimChars(modbusSimBus *bus, float characters);
+
+#ifdef __cplusplus
+}
+#endif
+#endif